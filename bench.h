@@ -0,0 +1,228 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Small benchmarks, run them with --bench <name>.
+  *
+*/
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <functional>
+#include <vector>
+#include <unistd.h>
+
+namespace bench
+{
+  // Average wall time of fn in milliseconds (after one warm-up call)
+  double _time( const std::function<void()>& fn, int reps = 10 )
+  {
+    fn();
+    if (DEVICE.is_cuda())
+      torch::cuda::synchronize();
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < reps; i++)
+      fn();
+    if (DEVICE.is_cuda())
+      torch::cuda::synchronize();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double,std::milli>(t1 - t0).count() / reps;
+  }
+
+  // Flat vs two-level Riemann head, loss (forward+backward), mean and
+  // quantiles for ntok tokens of width dmodel.
+  void Heads( int dmodel = 256, int ntok = 4096,
+              std::ostream& out = std::cout )
+  {
+    out << std::string(74, '-') << "\n"
+        << std::left
+        << std::setw(8)  << "nbin"
+        << std::setw(10) << "head"
+        << std::setw(14) << "params"
+        << std::setw(14) << "loss [ms]"
+        << std::setw(14) << "mean [ms]"
+        << std::setw(14) << "quant [ms]" << "\n"
+        << std::string(74, '-') << "\n";
+
+    auto p = torch::tensor({0.05, 0.5, 0.95}, torch::kFloat).to(DEVICE);
+
+    for (int nbin : {100, 1000, 5000})
+    {
+      auto bins = torch::linspace(-5, 5, nbin + 1);
+      auto h = torch::randn({ntok, 1, dmodel}, DEVICE);
+      auto y = torch::randn({ntok, 1, 1}, DEVICE);
+
+      torch::nn::Linear dec(dmodel, nbin);
+      dist::Riemann flat(bins);
+      dist::HierRiemann hier(bins, dmodel);
+      dec->to(DEVICE); flat->to(DEVICE); hier->to(DEVICE);
+
+      auto tflat = _time([&]{ flat(dec(h), y).backward(); });
+      auto thier = _time([&]{ hier(h, y).backward(); });
+
+      torch::NoGradGuard nograd;
+      auto mflat = _time([&]{ flat->mean(dec(h)); });
+      auto mhier = _time([&]{ hier->mean(h); });
+      auto qflat = _time([&]{ flat->predict_distribution(dec(h), p,
+                                                 c10::nullopt, 0.); });
+      auto qhier = _time([&]{ hier->quantile(h, p); });
+
+      out << std::left << std::fixed << std::setprecision(3)
+          << std::setw(8)  << nbin
+          << std::setw(10) << "flat"
+          << std::setw(14) << nparams(*dec)
+          << std::setw(14) << tflat
+          << std::setw(14) << mflat
+          << std::setw(14) << qflat << "\n"
+          << std::setw(8)  << nbin
+          << std::setw(10) << "two-level"
+          << std::setw(14) << nparams(*hier)
+          << std::setw(14) << thier
+          << std::setw(14) << mhier
+          << std::setw(14) << qhier << "\n";
+    }
+    out << std::string(74, '-') << "\n";
+  }
+
+  // Inference time of a single model over tables of growing width, nset
+  // datasets of nsamp rows (half of them queries) and 1..infeat columns.
+  template<class MODEL>
+  void Width( MODEL& model, int nsamp = 100, int nset = 20,
+              std::ostream& out = std::cout )
+  {
+    out << std::string(46, '-') << "\n"
+        << std::left
+        << std::setw(10) << "nfeat"
+        << std::setw(18) << "forward [ms]"
+        << std::setw(18) << "rows/s" << "\n"
+        << std::string(46, '-') << "\n";
+
+    model->to(DEVICE);
+    model->eval();
+    torch::NoGradGuard nograd;
+
+    const int ntst = nsamp / 2, ntrn = nsamp - ntst;
+    std::vector<int> widths;
+    for (int f = 1; f < model->infeat_; f *= 2)
+      widths.push_back(f);
+    widths.push_back(model->infeat_);
+
+    for (int nfeat : widths)
+    {
+      auto Xtrn = torch::randn({ntrn, nset, nfeat}, DEVICE);
+      auto ytrn = torch::randn({ntrn, nset, 1}, DEVICE);
+      auto Xtst = torch::randn({ntst, nset, nfeat}, DEVICE);
+
+      auto t = _time([&]{ model(Xtrn, ytrn, Xtst, c10::nullopt); });
+
+      out << std::left << std::fixed << std::setprecision(3)
+          << std::setw(10) << nfeat
+          << std::setw(18) << t
+          << std::setw(18) << std::setprecision(0)
+          << double(nsamp * nset) / t * 1000. << "\n";
+    }
+    out << std::string(46, '-') << "\n";
+  }
+
+  // Bytes of the last level cache (sysconf, 32 MB if it does not know)
+  size_t _llc( )
+  {
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return l3 > 0 ? l3 : l2 > 0 ? l2 : 32 << 20;
+  }
+
+  // Write over twice the last level cache, the next call starts cold
+  void _flush( )
+  {
+    static std::vector<char> junk(2 * _llc());
+    for (size_t i = 0; i < junk.size(); i += 64)
+      junk[i]++;
+  }
+
+  // Tied vs untied encoders at equal depth: stored weights, latency with
+  // the weights in cache (same model again) and cold (cache flushed before
+  // every call, as when many models take turns on a serving node), for a
+  // single dataset of nsamp rows and a batch of nset.
+  void Tied( int nencoder = 4, int nsamp = 100, int nset = 20,
+             std::ostream& out = std::cout )
+  {
+    out << "Last level cache: " << _llc() / (1 << 20) << " MB\n"
+        << std::string(78, '-') << "\n"
+        << std::left
+        << std::setw(8)  << "nshare"
+        << std::setw(8)  << "layers"
+        << std::setw(14) << "weights [MB]"
+        << std::setw(16) << "warm 1 [ms]"
+        << std::setw(16) << "cold 1 [ms]"
+        << std::setw(16) << "warm " + std::to_string(nset) + " [ms]" << "\n"
+        << std::string(78, '-') << "\n";
+
+    torch::NoGradGuard nograd;
+    const int ntst = nsamp / 2, ntrn = nsamp - ntst;
+
+    // the layers are shared in groups of nshare, so it has to divide nencoder
+    std::vector<int> shares = {1, 2, nencoder};
+    std::sort(shares.begin(), shares.end());
+    shares.erase(std::unique(shares.begin(), shares.end()), shares.end());
+    auto bad = [nencoder]( int s ) { return s < 1 || nencoder % s != 0; };
+    shares.erase(std::remove_if(shares.begin(), shares.end(), bad),
+                 shares.end());
+    for (int nshare : shares)
+    {
+      model::SimplePFN model(torch::linspace(-5, 5, 101), 256, 4, nencoder,
+                             512, 1, false, false, nshare);
+      model->to(DEVICE);
+      model->eval();
+
+      auto X1 = torch::randn({ntrn, 1, 1}, DEVICE);
+      auto y1 = torch::randn({ntrn, 1, 1}, DEVICE);
+      auto T1 = torch::randn({ntst, 1, 1}, DEVICE);
+      auto Xb = torch::randn({ntrn, nset, 1}, DEVICE);
+      auto yb = torch::randn({ntrn, nset, 1}, DEVICE);
+      auto Tb = torch::randn({ntst, nset, 1}, DEVICE);
+
+      auto warm = _time([&]{ model(X1, y1, T1, c10::nullopt); });
+      // the flush is timed separately and taken out
+      auto flush = _time([&]{ _flush(); });
+      auto cold = _time([&]{ _flush(); model(X1, y1, T1, c10::nullopt); })
+                  - flush;
+      auto batch = _time([&]{ model(Xb, yb, Tb, c10::nullopt); });
+
+      out << std::left << std::fixed << std::setprecision(3)
+          << std::setw(8)  << nshare
+          << std::setw(8)  << model->encoder->layers->size()
+          << std::setw(14) << 4. * nparams(*model) / (1 << 20)
+          << std::setw(16) << warm
+          << std::setw(16) << cold
+          << std::setw(16) << batch << "\n";
+    }
+    out << std::string(78, '-') << "\n";
+  }
+
+  // Sampling time of a batch of nset datasets per prior, with fresh buffers
+  // and with a warm arena
+  void Prior( const std::vector<std::pair<std::string,
+                                          const prior::Tasks*>>& priors,
+              int nset, int nsamp, int nfeat, std::ostream& out = std::cout )
+  {
+    out << std::string(60, '-') << "\n"
+        << std::left
+        << std::setw(20) << "prior"
+        << std::setw(20) << "fresh [ms]"
+        << std::setw(20) << "arena [ms]" << "\n"
+        << std::string(60, '-') << "\n";
+
+    for (const auto& [name, pr] : priors)
+    {
+      Arena arena;
+      auto fresh = _time([&]{ pr->Sample(nset, nsamp, nfeat); });
+      auto warm = _time([&]{ pr->Sample(nset, nsamp, nfeat, arena); });
+      out << std::left << std::fixed << std::setprecision(3)
+          << std::setw(20) << name
+          << std::setw(20) << fresh
+          << std::setw(20) << warm << "\n";
+    }
+    out << std::string(60, '-') << "\n";
+  }
+}
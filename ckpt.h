@@ -0,0 +1,163 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Complete training state in one checkpoint, so that a resume
+  * continues the run instead of restarting it:
+  *   version, model config (+ its hash), step ("epoch"), model (with the
+  *   Riemann borders), optimizer, schedule, RNG states and the flags.
+  * The model is still loadable by load_checkpoint/pfn_load as before.
+  * Files are written next to the target and renamed, a preemption in the
+  * middle of a save never leaves a broken checkpoint behind.
+  *
+  * The state is exact unless the batches are prefetched (--sampcores), then
+  * the batch that was drawn ahead of the save is drawn again. --bench resume
+  * checks it: the loss curve of a run that is resumed halfway has to be the
+  * one of the run straight through.
+*/
+#pragma once
+
+namespace ckpt
+{
+  constexpr int64_t VERSION = 1;
+
+  // FNV-1a, stable across compilers unlike std::hash
+  int64_t hash( const std::string& s )
+  {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : s)
+    {
+      h ^= c;
+      h *= 1099511628211ULL;
+    }
+    return static_cast<int64_t>(h);
+  }
+
+  // Everything that decides the shapes of the weights
+  template<class MODEL>
+  std::string config( const MODEL& model )
+  {
+    std::ostringstream oss;
+    oss << "d" << model->dmodel_ << "-h" << model->nhead_
+        << "-e" << model->nencoder_ << "-f" << model->nhid_
+        << "-x" << model->infeat_ << "-b" << model->nbin_
+        << "-t" << model->hier_ << "-p" << model->prep_;
+    if (model->nshare_ > 1)  // untied models keep their old config
+      oss << "-s" << model->nshare_;
+    return oss.str();
+  }
+
+  // Flags that change what the run trains on
+  std::string data( const CLIStore& conf )
+  {
+    return conf.GenName({"nsamp", "nset", "nfeat", "varfeat", "seed"});
+  }
+
+  template<class MODEL>
+  bool Save( const std::filesystem::path& dir, MODEL& model,
+             torch::optim::Optimizer& opt, const sched::Schedule& schedule,
+             int step, const CLIStore& conf )
+  {
+    try
+    {
+      const auto name = checkpoint_filename(step, dir);
+      torch::serialize::OutputArchive archive;
+
+      archive.write("version", torch::tensor(VERSION));
+      archive.write("config", c10::IValue(config(model)));
+      archive.write("hash", torch::tensor(hash(config(model))));
+      archive.write("data", c10::IValue(data(conf)));
+      archive.write("flags", c10::IValue(conf.GenName()));
+      archive.write("epoch", torch::tensor(step));
+
+      model->save(archive);
+
+      torch::serialize::OutputArchive optim;
+      opt.save(optim);
+      archive.write("optim", optim);
+
+      schedule.Save(archive);
+
+      archive.write("rng.cpu", at::detail::getDefaultCPUGenerator()
+                                 .get_state());
+      if (DEVICE.is_cuda())
+        archive.write("rng.cuda", at::globalContext()
+                                    .defaultGenerator(DEVICE).get_state());
+
+      auto tmp = name;
+      tmp += ".tmp";
+      archive.save_to(tmp.string());
+      std::filesystem::rename(tmp, name);
+      return true;
+    }
+    catch (const std::exception& e)
+    {
+      std::cerr << "Could not save checkpoint: " << e.what() << std::endl;
+      return false;
+    }
+  }
+
+  // Restore everything that is in the checkpoint, returns the step to run
+  // next (the checkpoint has the one that was trained last). The
+  // model has to be the one that wrote it (on the DEVICE already, the
+  // optimizer built on its parameters), the borders are overwritten.
+  // Checkpoints of older versions only have the model (and maybe the
+  // schedule), the rest stays as it is.
+  template<class MODEL>
+  int Load( const std::filesystem::path& path, MODEL& model,
+            torch::optim::Optimizer& opt, sched::Schedule& schedule,
+            const CLIStore& conf )
+  {
+    // straight to where the model lives, optimizer state included
+    torch::serialize::InputArchive archive;
+    archive.load_from(path.string(), DEVICE);
+
+    torch::Tensor t;
+    const int64_t version = archive.try_read("version", t) ?
+                            t.item<int64_t>() : 0;
+    TORCH_CHECK( version <= VERSION, "Checkpoint version ", version,
+                 " is newer than this program (", VERSION, ")." );
+
+    if (version >= 1)
+    {
+      c10::IValue v;
+      archive.read("config", v);
+      archive.read("hash", t);
+      TORCH_CHECK( t.item<int64_t>() == hash(config(model)) &&
+                   v.toStringRef() == config(model),
+                   "Checkpoint is of a ", v.toStringRef(),
+                   " model, this one is ", config(model) );
+
+      archive.read("data", v);
+      if (v.toStringRef() != data(conf))
+        PFN_LOG("Checkpoint trained with " << v.toStringRef()
+                << ", continuing with " << data(conf));
+    }
+
+    model->load(archive);
+
+    if (version >= 1)
+    {
+      torch::serialize::InputArchive optim;
+      archive.read("optim", optim);
+      opt.load(optim);
+
+      // the getters hand out const references, set_state needs a handle
+      archive.read("rng.cpu", t);
+      auto cpu = at::detail::getDefaultCPUGenerator();
+      cpu.set_state(t.cpu());
+      if (DEVICE.is_cuda() && archive.try_read("rng.cuda", t))
+      {
+        auto cuda = at::globalContext().defaultGenerator(DEVICE);
+        cuda.set_state(t.cpu());
+      }
+    }
+    else
+      PFN_LOG("Old checkpoint: no optimizer or random state, starting fresh.");
+
+    if (!schedule.Load(archive))
+      PFN_LOG("No schedule in the checkpoint, using the flags.");
+
+    archive.read("epoch", t);
+    return t.item<int>() + 1;
+  }
+}
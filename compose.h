@@ -0,0 +1,321 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Priors put together at compile time. A prior is an input
+  * sampler, a function sampler and a noise model,
+  *
+  *   using Mix = compose::Mixture<compose::Linear, compose::GP,
+  *                                compose::Warped<compose::Power,
+  *                                                compose::MLP>>;
+  *   auto pr = prior::erase(compose::Prior<compose::Normal, Mix,
+  *                                         compose::Gaussian>({}, {}, {0.1}));
+  *
+  * and sampling it is one batched routine without virtual calls: every part
+  * writes into the buffers it is given and keeps its intermediates in the
+  * arena, so once the arena is warm only a few small tensors are allocated.
+  * A mixture hands each component only its share of the datasets
+  * (contiguous blocks of the batch, the datasets are independent so their
+  * order does not matter), hence mixing costs as much as the components it
+  * picks.
+  *
+  * Parts
+  *   input     Fill(x [nset, nsamp, nfeat], arena)
+  *   function  Fill(x, y [nset, nsamp, 1], arena)   a new function per dataset
+  *   warp      Apply(x, out, arena)                 x -> out, same shape
+  *   noise     Add(y, arena)
+*/
+#pragma once
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <string>
+#include <tuple>
+#include <utility>
+
+namespace prior
+{
+  namespace compose
+  {
+    using Tensor = torch::Tensor;
+
+    // Arena key of one instance, so that nested parts of the same type
+    // never share a buffer
+    inline std::string _key( const char* what )
+    {
+      static std::atomic<int> n{0};
+      return std::string("compose.") + what + "." + std::to_string(n++);
+    }
+
+    //-------------------------------------------------------------------------
+    // Inputs
+    //-------------------------------------------------------------------------
+    struct Normal
+    {
+      double sd = 1.;
+      void Fill( Tensor x, Arena& ) const { x.normal_(0, sd); }
+    };
+
+    struct Uniform
+    {
+      double lo = -1., hi = 1.;
+      void Fill( Tensor x, Arena& ) const { x.uniform_(lo, hi); }
+    };
+
+    //-------------------------------------------------------------------------
+    // Functions
+    //-------------------------------------------------------------------------
+
+    // y = x w + b, w and b ~ N(0, sd) (LinearTasks without the noise)
+    struct Linear
+    {
+      double sd = 1.;
+      std::string w = _key("linear.w");
+
+      void Fill( const Tensor& x, Tensor y, Arena& arena ) const
+      {
+        const auto n = x.size(0), f = x.size(2);
+        auto wb = arena.Get(w, {n, f + 1, 1}, x.options()).normal_(0, sd);
+        // bias added inside the GEMM, no [x, 1] concatenation
+        torch::baddbmm_out(y, wb.narrow(1, f, 1), x, wb.narrow(1, 0, f));
+      }
+    };
+
+    // Gaussian process with an RBF kernel, approximated by nrff random
+    // Fourier features: y = sqrt(2 var / D) cos(x W + p) a
+    struct GP
+    {
+      double length = 1., var = 1.;
+      int nrff = 128;
+      std::string w = _key("gp.w"), p = _key("gp.p"), a = _key("gp.a"),
+                  z = _key("gp.z");
+
+      void Fill( const Tensor& x, Tensor y, Arena& arena ) const
+      {
+        const auto n = x.size(0), s = x.size(1), f = x.size(2);
+        auto W = arena.Get(w, {n, f, nrff}, x.options()).normal_(0, 1./length);
+        auto P = arena.Get(p, {n, 1, nrff}, x.options()).uniform_(0, 2*M_PI);
+        auto A = arena.Get(a, {n, nrff, 1}, x.options()).normal_();
+        auto Z = arena.Get(z, {n, s, nrff}, x.options());
+        torch::baddbmm_out(Z, P, x, W);
+        Z.cos_();
+        torch::bmm_out(y, Z, A);
+        y.mul_(std::sqrt(2. * var / nrff));
+      }
+    };
+
+    // Random one hidden layer tanh network
+    struct MLP
+    {
+      int hidden = 32;
+      double sd = 1.;
+      std::string w1 = _key("mlp.w1"), b1 = _key("mlp.b1"),
+                  w2 = _key("mlp.w2"), z = _key("mlp.z");
+
+      void Fill( const Tensor& x, Tensor y, Arena& arena ) const
+      {
+        const auto n = x.size(0), s = x.size(1), f = x.size(2);
+        auto W1 = arena.Get(w1, {n, f, hidden}, x.options())
+                    .normal_(0, sd / std::sqrt(double(f)));
+        auto B1 = arena.Get(b1, {n, 1, hidden}, x.options()).normal_(0, sd);
+        auto W2 = arena.Get(w2, {n, hidden, 1}, x.options())
+                    .normal_(0, 1. / std::sqrt(double(hidden)));
+        auto Z = arena.Get(z, {n, s, hidden}, x.options());
+        torch::baddbmm_out(Z, B1, x, W1);
+        Z.tanh_();
+        torch::bmm_out(y, Z, W2);
+      }
+    };
+
+    // F1 + F2
+    template<class F1, class F2>
+    struct Sum
+    {
+      F1 f1;
+      F2 f2;
+      std::string t = _key("sum");
+
+      void Fill( const Tensor& x, Tensor y, Arena& arena ) const
+      {
+        f1.Fill(x, y, arena);
+        auto tmp = arena.Get(t, y.sizes(), y.options());
+        f2.Fill(x, tmp, arena);
+        y.add_(tmp);
+      }
+    };
+
+    // A component per dataset, drawn with the given weights
+    template<class... Fs>
+    struct Mixture
+    {
+      std::tuple<Fs...> parts;
+      std::array<double, sizeof...(Fs)> weights;
+
+      Mixture( ) { weights.fill(1.); }
+      Mixture( Fs... fs ) : parts(fs...) { weights.fill(1.); }
+      Mixture( std::tuple<Fs...> fs,
+               std::array<double, sizeof...(Fs)> w ) :
+        parts(std::move(fs)), weights(w) { }
+
+      void Fill( const Tensor& x, Tensor y, Arena& arena ) const
+      {
+        const auto n = x.size(0);
+        auto w = torch::tensor(std::vector<double>(weights.begin(),
+                                                   weights.end()));
+        auto counts = torch::multinomial(w, n, true)
+                        .bincount({}, sizeof...(Fs));
+        auto c = counts.accessor<int64_t,1>();
+        _Fill(x, y, arena, c, std::index_sequence_for<Fs...>{});
+      }
+
+    private:
+      template<class C, size_t... I>
+      void _Fill( const Tensor& x, Tensor& y, Arena& arena, const C& c,
+                  std::index_sequence<I...> ) const
+      {
+        int64_t off = 0;
+        // each part fills its own block of datasets, skipped if empty
+        auto one = [&]( const auto& part, int64_t k )
+        {
+          if (k > 0)
+            part.Fill(x.narrow(0, off, k), y.narrow(0, off, k), arena);
+          off += k;
+        };
+        (one(std::get<I>(parts), c[I]), ...);
+      }
+    };
+
+    //-------------------------------------------------------------------------
+    // Input warps, F sees the warped inputs, the model the original ones
+    //-------------------------------------------------------------------------
+
+    // sign(x) |x|^p with p = exp(N(0, sd)) per dataset and feature
+    struct Power
+    {
+      double sd = 0.5;
+      std::string p = _key("power.p");
+
+      void Apply( const Tensor& x, Tensor out, Arena& arena ) const
+      {
+        auto P = arena.Get(p, {x.size(0), 1, x.size(2)}, x.options())
+                   .normal_(0, sd).exp_();
+        torch::abs_out(out, x);
+        out.pow_(P).copysign_(x);
+      }
+    };
+
+    // tanh(scale x)
+    struct Tanh
+    {
+      double scale = 1.;
+      void Apply( const Tensor& x, Tensor out, Arena& ) const
+      {
+        out.copy_(x).mul_(scale).tanh_();
+      }
+    };
+
+    template<class W, class F>
+    struct Warped
+    {
+      W warp;
+      F f;
+      std::string t = _key("warped");
+
+      void Fill( const Tensor& x, Tensor y, Arena& arena ) const
+      {
+        auto xw = arena.Get(t, x.sizes(), x.options());
+        warp.Apply(x, xw, arena);
+        f.Fill(xw, y, arena);
+      }
+    };
+
+    //-------------------------------------------------------------------------
+    // Noise
+    //-------------------------------------------------------------------------
+    struct Gaussian
+    {
+      double sd = 0.;
+      std::string e = _key("gaussian.e");
+
+      void Add( Tensor y, Arena& arena ) const
+      {
+        if (sd > 0.)
+          y.add_(arena.Get(e, y.sizes(), y.options()).normal_(0, sd));
+      }
+    };
+
+    struct Laplace
+    {
+      double scale = 0.1;
+      std::string e = _key("laplace.e");
+
+      // -b sign(u) log(1 - 2|u|), u ~ U(-1/2, 1/2), u = -1/2 is possible
+      // so the argument of the log is kept off 0
+      void Add( Tensor y, Arena& arena ) const
+      {
+        auto u = arena.Get(e, y.sizes(), y.options()).uniform_(-0.5, 0.5);
+        y.sub_(u.sign() * (1. - 2. * u.abs()).clamp_min_(1e-7).log_() * scale);
+      }
+    };
+
+    //-------------------------------------------------------------------------
+    // Prior : the whole sampling routine, same layout as prior::Tasks
+    // (sequence first, x [nsamp, nset, nfeat] and y [nsamp, nset, 1])
+    //-------------------------------------------------------------------------
+    template<class IN, class F, class NOISE>
+    struct Prior
+    {
+      IN in;
+      F f;
+      NOISE noise;
+      std::string x = _key("prior.x"), y = _key("prior.y");
+
+      Prior( IN i = {}, F fn = {}, NOISE e = {} ) :
+        in(std::move(i)), f(std::move(fn)), noise(std::move(e)) { }
+
+      std::tuple<Tensor, Tensor>
+      Sample( int nset, int nsamp, int nfeat, Arena& arena ) const
+      {
+        auto X = arena.Get(x, {nset, nsamp, nfeat});
+        auto Y = arena.Get(y, {nset, nsamp, 1});
+        in.Fill(X, arena);
+        f.Fill(X, Y, arena);
+        noise.Add(Y, arena);
+        return std::make_tuple(X.transpose(0, 1), Y.transpose(0, 1));
+      }
+    };
+  }
+
+  //---------------------------------------------------------------------------
+  // Erased : a composed prior behind the Tasks interface (train::Simple,
+  // borders, ...), one virtual call per batch. Without an arena the buffers
+  // are fresh every call.
+  //---------------------------------------------------------------------------
+  template<class P>
+  class Erased final : public Tasks
+  {
+  public:
+    explicit Erased( P p ) : p_(std::move(p)) { }
+
+    std::tuple<Tensor, Tensor>
+    Sample( int nset, int nsamp, int nfeat ) const override
+    {
+      Arena arena;
+      return p_.Sample(nset, nsamp, nfeat, arena);
+    }
+
+    std::tuple<Tensor, Tensor>
+    Sample( int nset, int nsamp, int nfeat, Arena& arena ) const override
+    {
+      return p_.Sample(nset, nsamp, nfeat, arena);
+    }
+
+  private:
+    P p_;
+  };
+
+  template<class P>
+  Erased<P> erase( P p )
+  {
+    return Erased<P>(std::move(p));
+  }
+}
@@ -0,0 +1,246 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Encoded train context that can grow row by row, for the
+  * streaming use case. Instead of re-encoding the whole train set for each
+  * prediction we keep the input of every encoder layer for the train rows.
+  *  - New rows attend to the stored rows and to each other, the stored rows
+  *    are NOT revisited. Hence, appending everything at once is exactly
+  *    SimplePFN::forward, appending in pieces is an approximation.
+  *  - Test rows attend to the stored rows and themselves (same as the mask).
+  *  - With a preprocessing model the statistics come from the first Append.
+  * There are no positional encodings so the slot a row lives in does not
+  * matter, which lets us keep a fixed size buffer per layer. Behind the
+  * capacity it has room for the rows of an Append, they are staged right
+  * after the stored ones so that the keys/values are a view of the buffer:
+  * an Append copies its own rows, never the stored ones.
+*/
+#pragma once
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <random>
+#include <limits>
+
+namespace model
+{
+  enum class Evict { Window, Reservoir };
+
+  class Context
+  {
+  public:
+    Context( SimplePFN model, int64_t capacity,
+             Evict policy = Evict::Window, size_t seed = 0 ) :
+      model_(model), cap_(capacity), policy_(policy), gen_(seed)
+    {
+      TORCH_CHECK( cap_ > 0, "Context capacity must be positive." );
+    }
+
+    // Encode the new rows against the current context and store them
+    // X: [n, B, nfeat], y: [n, B, 1]
+    void Append( const torch::Tensor& X, const torch::Tensor& y )
+    {
+      torch::NoGradGuard nograd;
+      const auto n = X.size(0);
+      if (n == 0)
+        return;
+
+      if (model_->prep_ && states_.empty())
+        stats_ = prep::fit(X, y);
+
+      auto h = model_->prep_ ?
+        model_->embed(prep::x(X, stats_), prep::y(y, stats_), X.narrow(0,0,0)):
+        model_->embed(X, y, X.narrow(0, 0, 0));
+
+      TORCH_CHECK( states_.empty() || h.size(1) == states_[0].size(1),
+                   "Batch size of the context can not change." );
+      _Reserve(n, h);
+
+      auto slots = _slots(n);
+
+      for (int l = 0; l < _nlayers(); l++)
+      {
+        states_[l].narrow(0, size_, n).copy_(h);
+        auto next = _layer(l, h, states_[l].narrow(0, 0, size_ + n), {});
+        states_[l].index_copy_(0, slots.second, h.index_select(0,slots.first));
+        h = next;
+      }
+      size_ = std::min(size_ + n, cap_);
+    }
+
+    // Encoder output of the test rows Xtst: [m, B, nfeat] -> [m, B, d]
+    // The features, the mask and the keys/values of each layer go to the
+    // buffers of arena if it is given, it belongs to the caller (the
+    // predictions only read the context, they may run concurrently).
+    torch::Tensor Hidden( const torch::Tensor& Xtst, Arena* arena = nullptr )
+    {
+      torch::NoGradGuard nograd;
+      TORCH_CHECK( size_ > 0, "Context is empty, Append some rows first." );
+
+      const auto m = Xtst.size(0);
+      auto x = model_->prep_ ? prep::x(Xtst, stats_) : Xtst;
+      auto h = model_->embed(x.narrow(0, 0, 0),
+                              x.narrow(0, 0, 0).narrow(2, 0, 1), x, arena);
+
+      // test rows see the whole context and only themselves
+      const std::vector<int64_t> shape = {m, size_ + m};
+      auto mask = arena ? arena->Get("ctx.mask", shape, h.options())
+                        : torch::empty(shape, h.options());
+      mask.narrow(1, 0, size_).zero_();
+      auto self = mask.narrow(1, size_, m);
+      self.fill_(-std::numeric_limits<float>::infinity());
+      self.diagonal().fill_(0.);
+
+      for (int l = 0; l < _nlayers(); l++)
+      {
+        auto kv = arena ?
+          torch::cat_out(arena->Get("ctx.kv", {0}, h.options()),
+                         {_stored(l), h}, 0) :
+          torch::cat({_stored(l), h}, 0);
+        h = _layer(l, h, kv, mask);
+      }
+
+      return h;
+    }
+
+    // Logits of the test rows Xtst: [m, B, nfeat] -> [m, B, nbin]
+    // (in the standardized target space for a preprocessing model)
+    torch::Tensor Logits( const torch::Tensor& Xtst, Arena* arena = nullptr )
+    {
+      TORCH_CHECK( !model_->hier_, "The two-level head has no flat logits." );
+      torch::NoGradGuard nograd;
+      return model_->decoder(Hidden(Xtst, arena));
+    }
+
+    // Predictive mean [m, B]
+    torch::Tensor Predict( const torch::Tensor& Xtst, Arena* arena = nullptr )
+    {
+      torch::NoGradGuard nograd;
+      auto mean = model_->hier_ ? model_->hloss->mean(Hidden(Xtst, arena))
+                                : model_->loss->mean(Logits(Xtst, arena));
+      return model_->prep_ ? prep::unscale(mean, stats_) : mean;
+    }
+
+    // Quantiles [m, B, Q] at the levels p [Q]
+    torch::Tensor Quantiles( const torch::Tensor& Xtst, const torch::Tensor& p,
+                             Arena* arena = nullptr )
+    {
+      torch::NoGradGuard nograd;
+      auto res = model_->hier_ ?
+        model_->hloss->quantile(Hidden(Xtst, arena), p) :
+        model_->loss->predict_distribution(Logits(Xtst, arena), p,
+                                           c10::nullopt, 0.).quantiles;
+      return model_->prep_ ? prep::unscale(res, stats_) : res;
+    }
+
+    int64_t Size( ) const { return size_; }
+    int64_t Seen( ) const { return seen_; }
+
+    void Reset( )
+    {
+      states_.clear();
+      stats_ = {};
+      size_ = 0;
+      seen_ = 0;
+      pos_ = 0;
+    }
+
+  private:
+    SimplePFN model_;
+    int64_t cap_;
+    Evict policy_;
+    std::mt19937_64 gen_;
+
+    std::vector<torch::Tensor> states_; // input of each layer, [cap, B, d]
+                                        // + the staging rows
+    prep::Stats stats_;                 // preprocessing of the first Append
+    int64_t size_ = 0;                  // occupied slots
+    int64_t seen_ = 0;                  // rows appended so far
+    int64_t pos_ = 0;                   // oldest slot for Evict::Window
+
+    int _nlayers( ) const
+    {
+      return model_->nencoder_;
+    }
+
+    torch::Tensor _stored( int l ) const
+    {
+      return states_[l].narrow(0, 0, size_);
+    }
+
+    // Room for the stored rows and n staged ones. The buffers only grow (at
+    // least doubling the staging rows), so this copies the stored rows a
+    // few times over the life of the context, not on every Append.
+    void _Reserve( int64_t n, const torch::Tensor& h )
+    {
+      const int64_t stage = states_.empty() ? 0 : states_[0].size(0) - cap_;
+      if (!states_.empty() && stage >= n)
+        return;
+      const int64_t rows = cap_ + std::max(n, 2 * stage);
+      for (int l = 0; l < _nlayers(); l++)
+      {
+        auto buf = torch::empty({rows, h.size(1), h.size(2)}, h.options());
+        if (l < int(states_.size()))
+        {
+          buf.narrow(0, 0, size_).copy_(_stored(l));
+          states_[l] = buf;
+        }
+        else
+          states_.push_back(buf);
+      }
+    }
+
+    // One post-norm encoder layer with separate queries and keys/values.
+    // Follows TransformerEncoderLayerImpl::forward (dropout is 0 in the PFN).
+    torch::Tensor _layer( int l, const torch::Tensor& q,
+                          const torch::Tensor& kv,
+                          const torch::Tensor& mask )
+    {
+      auto& layer = model_->layer(l);
+      auto att = std::get<0>(layer.self_attn->forward(q, kv, kv, {}, false, mask));
+      auto h = layer.norm1(q + att);
+      return layer.norm2(h + layer.linear2(torch::relu(layer.linear1(h))));
+    }
+
+    // Decide where the n new rows go. Returns (rows to keep, their slots),
+    // if two rows end up in the same slot the later one wins.
+    std::pair<torch::Tensor,torch::Tensor> _slots( int64_t n )
+    {
+      std::map<int64_t,int64_t> slot2row;
+      int64_t size = size_;
+
+      for (int64_t i = 0; i < n; i++, seen_++)
+      {
+        int64_t slot = -1;
+        if (size < cap_)
+          slot = size++;
+        else if (policy_ == Evict::Window)
+        {
+          slot = pos_;
+          pos_ = (pos_ + 1) % cap_;
+        }
+        else
+        {
+          // reservoir: keep the new row with probability cap/seen
+          std::uniform_int_distribution<int64_t> dist(0, seen_);
+          auto j = dist(gen_);
+          if (j < cap_)
+            slot = j;
+        }
+        if (slot >= 0)
+          slot2row[slot] = i;
+      }
+
+      std::vector<int64_t> rows, slots;
+      for (const auto& [slot, row] : slot2row)
+      {
+        slots.push_back(slot);
+        rows.push_back(row);
+      }
+      auto opts = torch::TensorOptions().dtype(torch::kLong)
+                                        .device(states_[0].device());
+      return std::make_pair(torch::tensor(rows, opts),
+                            torch::tensor(slots, opts));
+    }
+  };
+}
@@ -0,0 +1,95 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Test-time ensembling of a PFN. All members are stacked along
+  * the batch dimension and answered by a single forward pass.
+  *
+*/
+#pragma once
+#include <vector>
+
+namespace model
+{
+  // Every member m sees the dataset as
+  //   x' = (x * s_m)[perm_m]      feature rescaling + permutation
+  //   y' = a_m * y + b_m          target rescaling + shift
+  // member 0 is always the untouched dataset.
+  struct EnsembleOptions
+  {
+    int members = 8;
+    bool permute = true;    // permute the features
+    double xscale = 0.1;    // log-std of the feature rescaling
+    double yscale = 0.1;    // log-std of the target rescaling
+    double yshift = 0.1;    // std of the shift (in units of std(ytrn))
+  };
+
+  template<class MODEL>
+  torch::Tensor ensemble_logits( MODEL& model,
+                                 const torch::Tensor& Xtrn,
+                                 const torch::Tensor& ytrn,
+                                 const torch::Tensor& Xtst,
+                                 const EnsembleOptions& opts = {} )
+  {
+    torch::NoGradGuard nograd;
+
+    const int K = opts.members;
+    const auto B = Xtrn.size(1);
+    const auto nfeat = Xtrn.size(2);
+    TORCH_CHECK( K > 0, "Ensemble needs at least one member." );
+    TORCH_CHECK( !model->prep_,
+                 "Ensembles bring their own transforms, use a model without"
+                 " preprocessing." );
+
+    auto fopts = Xtrn.options();
+    auto xs = torch::exp(opts.xscale * torch::randn({K, nfeat}, fopts));
+    auto a  = torch::exp(opts.yscale * torch::randn({K}, fopts));
+    auto b  = opts.yshift * torch::randn({K}, fopts) * ytrn.std();
+    xs[0].fill_(1.); a[0].fill_(1.); b[0].fill_(0.);
+
+    std::vector<torch::Tensor> trn, tst, ys;
+    trn.reserve(K); tst.reserve(K); ys.reserve(K);
+
+    for (int m = 0; m < K; m++)
+    {
+      auto perm = (opts.permute && m > 0) ?
+        torch::randperm(nfeat, fopts.dtype(torch::kLong)) :
+        torch::arange(nfeat, fopts.dtype(torch::kLong));
+
+      trn.push_back((Xtrn * xs[m]).index_select(2, perm));
+      tst.push_back((Xtst * xs[m]).index_select(2, perm));
+      ys.push_back(ytrn * a[m] + b[m]);
+    }
+
+    // [Ntst, K*B, nbin] member-major along the batch
+    auto out = model->logits(torch::cat(trn, 1),
+                             torch::cat(ys, 1),
+                             torch::cat(tst, 1));
+
+    auto& rie = *model->loss;
+    auto probs = torch::softmax(out, -1).view({out.size(0), K, B, -1});
+
+    // Invert y' = a*y + b: the mass of the bucket [l,u) in the original scale
+    // is F'(a*u+b) - F'(a*l+b) for the member's predictive CDF F'.
+    auto t = (a.view({K, 1}) * rie.bins_.view({1, -1}) + b.view({K, 1}))
+               .view({1, K, 1, -1});
+    auto cdf = rie._cdf(probs, t);
+
+    using namespace torch::indexing;
+    auto mass = cdf.index({"...", Slice(1, None)}) -
+                cdf.index({"...", Slice(None, -1)});
+    mass = mass.mean(1);
+    mass = mass / mass.sum(-1, true).clamp_min(1e-12);
+
+    return torch::log(mass.clamp_min(1e-12));
+  }
+
+  template<class MODEL>
+  torch::Tensor ensemble_mean( MODEL& model,
+                               const torch::Tensor& Xtrn,
+                               const torch::Tensor& ytrn,
+                               const torch::Tensor& Xtst,
+                               const EnsembleOptions& opts = {} )
+  {
+    return model->loss->mean(ensemble_logits(model, Xtrn, ytrn, Xtst, opts));
+  }
+}
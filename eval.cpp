@@ -0,0 +1,76 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Evaluation of a trained SimplePFN checkpoint against the
+  * exact Bayesian linear regression posterior, see eval.h.
+  *
+  *   eval --path simple/epoch_100.pt --nsamps 50,100,200 --nfeats 1,2,4
+*/
+#ifndef PRINT_
+#define PRINT(x) std::cout << #x << " =\n" << x << std::endl;
+#endif
+
+#include <torch/torch.h>
+#include <filesystem>
+#include <iostream>
+#include "utils.h"
+#include "riemann.h"
+#include "preprocess.h"
+#include "prior.h"
+#include "model.h"
+#include "bench.h"
+#include "runtime.h"
+#include "eval.h"
+
+int main(int argc, char** argv)
+{
+  namespace fs = std::filesystem;
+  CLIStore& conf = CLIStore::GetInstance();
+
+  conf.Register<fs::path>("path", "./simple/epoch_10.pt");
+  conf.Register<size_t>("seed", 7);
+  conf.Register<size_t>("nbin", 100);
+  conf.Register<size_t>("nfeat", 1);
+  conf.Register<size_t>("nset", 64);
+  conf.Register<bool>("hier", false);
+  conf.Register<bool>("prep", false);
+  conf.Register<int>("nshare", 1);
+  conf.Register<std::string>("nsamps", "50,100,200");
+  conf.Register<std::string>("nfeats", "1");
+  conf.Register<int>("intra", 0);
+  conf.Register<int>("inter", 0);
+  conf.Register<int>("numa", -1);
+  conf.Register<std::string>("cores", "");
+
+  conf.Parse(argc, argv);
+  conf.Print();
+  runtime::Configure(conf);
+
+  // the borders are overwritten by the checkpoint
+  auto pfn = model::SimplePFN(torch::linspace(0, 1, conf.Get<size_t>("nbin")+1),
+                              256, 4, 4, 512, conf.Get<size_t>("nfeat"),
+                              conf.Get<bool>("hier"), conf.Get<bool>("prep"),
+                              conf.Get<int>("nshare"));
+  TORCH_CHECK( load_weights(conf.Get<fs::path>("path"), pfn),
+               "Could not load the model ", conf.Get<fs::path>("path") );
+
+  auto pr = prior::LinearTasks(0, 1, 1);
+
+  std::vector<eval::Suite> suites;
+  for (int nsamp : parse_list(conf.Get<std::string>("nsamps")))
+    for (int nfeat : parse_list(conf.Get<std::string>("nfeats")))
+    {
+      if (nfeat > pfn->infeat_)
+      {
+        PFN_LOG("Skipping nfeat " << nfeat << ", the model takes up to "
+                << pfn->infeat_);
+        continue;
+      }
+      suites.push_back(eval::make_suite(pr, conf.Get<size_t>("nset"),
+                                        nsamp, nfeat,
+                                        conf.Get<size_t>("seed")));
+    }
+
+  eval::Run(pfn, pr, suites);
+  return 0;
+}
@@ -0,0 +1,159 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Accuracy vs cost of SimplePFN against the exact Bayesian
+  * posterior predictive of LinearTasks (Bayesian linear regression with the
+  * same Gaussian priors). Both run batched over fixed held-out suites of
+  * tasks, one suite per (nsamp, nfeat).
+*/
+#pragma once
+#include <cmath>
+#include <iomanip>
+
+namespace eval
+{
+  using Tensor = torch::Tensor;
+
+  // Held-out tasks, the same ones on every run with the same seed
+  struct Suite
+  {
+    int nsamp, nfeat;
+    Tensor Xtrn, ytrn, Xtst, ytst;
+  };
+
+  template<class PRIOR>
+  Suite make_suite( const PRIOR& prior, int nset, int nsamp, int nfeat,
+                    size_t seed )
+  {
+    torch::manual_seed(seed + 1000 * nsamp + nfeat);
+    auto sets = split(prior.Sample(nset, nsamp, nfeat), nsamp / 2);
+    return { nsamp, nfeat,
+             std::get<0>(sets).to(DEVICE), std::get<2>(sets).to(DEVICE),
+             std::get<1>(sets).to(DEVICE), std::get<3>(sets).to(DEVICE) };
+  }
+
+  // Posterior predictive of y = [x, 1] w + e, w ~ N(0, c^2 I), e ~ N(0, a^2)
+  // for all datasets at once. Returns the mean and variance [m, B].
+  // a = 0 is regularized with a tiny noise, the exact answer is a delta.
+  std::pair<Tensor,Tensor> blr( const Tensor& Xtrn, const Tensor& ytrn,
+                                const Tensor& Xtst, double a, double c )
+  {
+    auto phi = [&]( const Tensor& X )
+    {
+      auto Xb = X.transpose(0, 1);  // [B, n, f]
+      return torch::cat({Xb, torch::ones({Xb.size(0), Xb.size(1), 1},
+                                         Xb.options())}, 2);
+    };
+    auto P = phi(Xtrn), Q = phi(Xtst);
+    auto y = ytrn.transpose(0, 1);  // [B, n, 1]
+    const double s2 = std::max(a * a, 1e-6);
+
+    // posterior precision and its Cholesky factor
+    auto eye = torch::eye(P.size(2), P.options());
+    auto A = torch::matmul(P.transpose(1, 2), P) / s2 + eye / (c * c);
+    auto L = torch::linalg_cholesky(A);
+
+    auto w = torch::cholesky_solve(torch::matmul(P.transpose(1, 2), y) / s2,
+                                   L);
+    auto mean = torch::matmul(Q, w).squeeze(-1);
+    auto v = torch::cholesky_solve(Q.transpose(1, 2), L);  // A^-1 Q^t
+    auto var = (Q * v.transpose(1, 2)).sum(-1) + s2;
+    return { mean.transpose(0, 1), var.transpose(0, 1) };
+  }
+
+  // Predictive mean [m, B] and the average NLL (density) of the PFN
+  template<class MODEL>
+  std::pair<Tensor,Tensor> pfn( MODEL& model, const Suite& s )
+  {
+    // hidden standardizes with the same statistics as these
+    auto h = model->hidden(s.Xtrn, s.ytrn, s.Xtst);
+    prep::Stats st;
+    Tensor y = s.ytst;
+    if (model->prep_)
+    {
+      st = prep::fit(s.Xtrn, s.ytrn);
+      y = prep::target(s.ytst, st);
+    }
+
+    Tensor mean, nll;
+    if (model->hier_)
+    {
+      mean = model->hloss->mean(h);
+      nll = model->hloss->nll(h, y);
+    }
+    else
+    {
+      auto res = model->loss->predict_distribution(model->decoder(h),
+                                                   c10::nullopt, y, 0.);
+      mean = res.mean;
+      nll = res.nll.mean();
+    }
+
+    if (model->prep_)
+    {
+      mean = prep::unscale(mean, st);
+      nll = nll + st.ystd.log().mean();
+    }
+    return { mean, nll };
+  }
+
+  // One line per suite and method, gaps are PFN - exact
+  template<class MODEL, class O>
+  void Run( MODEL& model, const prior::LinearTasks<O>& prior,
+            const std::vector<Suite>& suites, std::ostream& out = std::cout )
+  {
+    torch::NoGradGuard nograd;
+    model->to(DEVICE);
+    model->eval();
+
+    out << std::string(96, '-') << "\n" << std::left
+        << std::setw(8)  << "nsamp"
+        << std::setw(8)  << "nfeat"
+        << std::setw(8)  << "method"
+        << std::setw(12) << "nll"
+        << std::setw(12) << "mse"
+        << std::setw(12) << "nll gap"
+        << std::setw(12) << "mse gap"
+        << std::setw(12) << "time [ms]"
+        << std::setw(12) << "samples/s" << "\n"
+        << std::string(96, '-') << "\n";
+
+    for (const auto& s : suites)
+    {
+      const auto ntok = double(s.Xtrn.size(1)) * s.nsamp;
+      const double a = prior.Noise(), c = prior.Weight();
+
+      auto [bmean, bvar] = blr(s.Xtrn, s.ytrn, s.Xtst, a, c);
+      auto y = s.ytst.squeeze(-1);
+      auto bnll = (0.5 * torch::log(2. * M_PI * bvar) +
+                   (y - bmean).square() / (2. * bvar)).mean()
+                   .template item<double>();
+      auto bmse = (y - bmean).square().mean().template item<double>();
+      auto btime = bench::_time([&]{ blr(s.Xtrn, s.ytrn, s.Xtst, a, c); });
+
+      auto [pmean, pnll] = pfn(model, s);
+      auto mnll = pnll.template item<double>();
+      auto mmse = (y - pmean).square().mean().template item<double>();
+      auto ptime = bench::_time([&]{ pfn(model, s); });
+
+      auto row = [&]( const char* name, double nll, double mse,
+                      double gnll, double gmse, double t )
+      {
+        out << std::left << std::fixed << std::setprecision(4)
+            << std::setw(8)  << s.nsamp
+            << std::setw(8)  << s.nfeat
+            << std::setw(8)  << name
+            << std::setw(12) << nll
+            << std::setw(12) << mse
+            << std::setw(12) << gnll
+            << std::setw(12) << gmse
+            << std::setw(12) << std::setprecision(3) << t
+            << std::setw(12) << std::setprecision(0) << ntok / t * 1000.
+            << "\n";
+      };
+      row("exact", bnll, bmse, 0., 0., btime);
+      row("pfn", mnll, mmse, mnll - bnll, mmse - bmse, ptime);
+    }
+    out << std::string(96, '-') << "\n";
+  }
+}
@@ -0,0 +1,323 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Reading and writing dense numeric tables. The binary format
+  * is columnar float32:
+  *
+  *   header (64 bytes): "PFNTAB01", nrow (int64), ncol (int64), zeros
+  *   data: column 0 (nrow floats), column 1, ..., column ncol-1
+  *
+  * Tables are memory mapped and handed out as zero-copy tensors. A
+  * multithreaded CSV parser converts CSV into this format (missing or non
+  * numeric fields become NaN, a first line with text in it is a header).
+  * Linux/POSIX only.
+*/
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace io
+{
+  constexpr char MAGIC[8] = {'P','F','N','T','A','B','0','1'};
+  constexpr size_t HEADER = 64;
+
+  //---------------------------------------------------------------------------
+  // Map : a memory mapped file, unmapped when the last user goes away
+  //---------------------------------------------------------------------------
+  class Map
+  {
+  public:
+    // Map an existing file for reading. The pages are copy on write, writes
+    // (in-place ops on the tensors of a Table) stay in this process and
+    // never reach the file.
+    explicit Map( const std::filesystem::path& path )
+    {
+      fd_ = ::open(path.c_str(), O_RDONLY);
+      TORCH_CHECK( fd_ >= 0, "Could not open ", path.string() );
+      struct stat st;
+      fstat(fd_, &st);
+      size_ = st.st_size;
+      _Map(PROT_READ | PROT_WRITE, MAP_PRIVATE);
+    }
+
+    // Create (or truncate) a file of the given size and map it for writing
+    Map( const std::filesystem::path& path, size_t size ) : size_(size)
+    {
+      fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      TORCH_CHECK( fd_ >= 0, "Could not create ", path.string() );
+      TORCH_CHECK( ftruncate(fd_, size_) == 0,
+                   "Could not resize ", path.string() );
+      _Map(PROT_READ | PROT_WRITE, MAP_SHARED);
+    }
+
+    ~Map( )
+    {
+      if (data_ != nullptr && data_ != MAP_FAILED)
+        munmap(data_, size_);
+      if (fd_ >= 0)
+        ::close(fd_);
+    }
+
+    Map( const Map& ) = delete;
+    Map& operator=( const Map& ) = delete;
+
+    char* Data( ) const { return static_cast<char*>(data_); }
+    size_t Size( ) const { return size_; }
+
+  private:
+    int fd_ = -1;
+    size_t size_ = 0;
+    void* data_ = nullptr;
+
+    void _Map( int prot, int flags )
+    {
+      if (size_ == 0)
+        return;
+      data_ = mmap(nullptr, size_, prot, flags, fd_, 0);
+      TORCH_CHECK( data_ != MAP_FAILED, "Could not map the file." );
+      madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+  };
+
+  //---------------------------------------------------------------------------
+  // Table : a mapped binary table, the tensors point into the mapping and
+  // keep it alive. Changing them is fine but only this process sees it (and
+  // every tensor of the same columns, they share the pages).
+  //---------------------------------------------------------------------------
+  class Table
+  {
+  public:
+    explicit Table( const std::filesystem::path& path ) :
+      map_(std::make_shared<Map>(path))
+    {
+      TORCH_CHECK( map_->Size() >= HEADER &&
+                   std::memcmp(map_->Data(), MAGIC, sizeof(MAGIC)) == 0,
+                   path.string(), " is not a PFN table." );
+      std::memcpy(&nrow_, map_->Data() + 8, sizeof(int64_t));
+      std::memcpy(&ncol_, map_->Data() + 16, sizeof(int64_t));
+      TORCH_CHECK( map_->Size() == HEADER + sizeof(float) * nrow_ * ncol_,
+                   path.string(), " is truncated." );
+    }
+
+    int64_t Rows( ) const { return nrow_; }
+    int64_t Cols( ) const { return ncol_; }
+
+    // Columns [from, from+n) as [nrow, 1, n], the sequence first layout of
+    // a single dataset that SimplePFN takes.
+    torch::Tensor Columns( int64_t from, int64_t n ) const
+    {
+      TORCH_CHECK( from >= 0 && n >= 0 && from + n <= ncol_,
+                   "Columns out of range." );
+      auto keep = map_;
+      auto data = reinterpret_cast<float*>(map_->Data() + HEADER)
+                + from * nrow_;
+      return torch::from_blob(data, {nrow_, 1, n}, {1, nrow_ * n, nrow_},
+                              [keep](void*) { }, torch::kFloat);
+    }
+
+    torch::Tensor Column( int64_t j ) const
+    {
+      return Columns(j, 1);
+    }
+
+  private:
+    std::shared_ptr<Map> map_;
+    int64_t nrow_ = 0, ncol_ = 0;
+  };
+
+  // Write data [nrow, ncol] (or [nrow] for a single column) as a table
+  void save_table( const std::filesystem::path& path,
+                   const torch::Tensor& data )
+  {
+    auto cols = data.dim() == 1 ? data.unsqueeze(1) : data;
+    TORCH_CHECK( cols.dim() == 2, "Tables are 2D." );
+    const int64_t nrow = cols.size(0), ncol = cols.size(1);
+
+    Map out(path, HEADER + sizeof(float) * nrow * ncol);
+    std::memset(out.Data(), 0, HEADER);
+    std::memcpy(out.Data(), MAGIC, sizeof(MAGIC));
+    std::memcpy(out.Data() + 8, &nrow, sizeof(int64_t));
+    std::memcpy(out.Data() + 16, &ncol, sizeof(int64_t));
+
+    // the transpose makes it columnar
+    torch::from_blob(out.Data() + HEADER, {ncol, nrow}, torch::kFloat)
+      .copy_(cols.t());
+  }
+
+  // Convert a CSV file into a binary table, returns the number of rows.
+  // The file is split in nthreads chunks at line boundaries, every thread
+  // counts its rows and then parses them straight into the mapped output.
+  int64_t csv_to_table( const std::filesystem::path& csv,
+                        const std::filesystem::path& path,
+                        int nthreads = 0 )
+  {
+    Map in(csv);
+    const char* begin = in.Data();
+    const char* end = begin + in.Size();
+    TORCH_CHECK( in.Size() > 0, csv.string(), " is empty." );
+
+    auto eol = [&]( const char* p )
+    {
+      auto q = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      return q == nullptr ? end : q;
+    };
+
+    // parse one field, NaN if it is not a number
+    auto field = [&]( const char*& p, const char* stop ) -> float
+    {
+      while (p < stop && (*p == ' ' || *p == '\t'))
+        p++;
+      float v = std::numeric_limits<float>::quiet_NaN();
+      auto res = std::from_chars(p, stop, v);
+      if (res.ec != std::errc())
+        v = std::numeric_limits<float>::quiet_NaN();
+      const char* comma = static_cast<const char*>(
+                            std::memchr(p, ',', stop - p));
+      p = comma == nullptr ? stop : comma + 1;
+      return v;
+    };
+
+    // text that is not a number, empty fields (missing values) are not
+    auto text = [&]( const char* p, const char* stop )
+    {
+      while (p < stop && (*p == ' ' || *p == '\t'))
+        p++;
+      while (stop > p && (stop[-1] == ' ' || stop[-1] == '\t' ||
+                          stop[-1] == '\r'))
+        stop--;
+      float v;
+      return p < stop && std::from_chars(p, stop, v).ptr != stop;
+    };
+
+    // the first line tells the number of columns and if there is a header
+    // (a field with text in it)
+    const char* first = eol(begin);
+    const int64_t ncol = std::count(begin, first, ',') + 1;
+    const char* data = begin;
+    for (const char* p = begin; ; )
+    {
+      auto comma = static_cast<const char*>(std::memchr(p, ',', first - p));
+      if (text(p, comma == nullptr ? first : comma))
+      {
+        data = first == end ? end : first + 1;
+        break;
+      }
+      if (comma == nullptr)
+        break;
+      p = comma + 1;
+    }
+
+    if (nthreads <= 0)
+      nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<const char*> cuts(nthreads + 1, end);
+    cuts[0] = data;
+    for (int t = 1; t < nthreads; t++)
+    {
+      auto p = data + (end - data) * t / nthreads;
+      p = std::max(p, cuts[t-1]);
+      cuts[t] = p == end ? end : std::min(end, eol(p) + 1);
+    }
+
+    auto blank = [&]( const char* p, const char* q )
+    {
+      for (; p < q; p++)
+        if (*p != ' ' && *p != '\t' && *p != '\r')
+          return false;
+      return true;
+    };
+
+    auto parallel = [&]( auto fn )
+    {
+      std::vector<std::thread> threads;
+      for (int t = 0; t < nthreads; t++)
+        threads.emplace_back(fn, t);
+      for (auto& th : threads)
+        th.join();
+    };
+
+    // rows per chunk
+    std::vector<int64_t> rows(nthreads + 1, 0);
+    parallel([&]( int t )
+    {
+      for (const char* p = cuts[t]; p < cuts[t+1]; )
+      {
+        auto q = eol(p);
+        if (!blank(p, q))
+          rows[t+1]++;
+        p = q + 1;
+      }
+    });
+    for (int t = 0; t < nthreads; t++)
+      rows[t+1] += rows[t];
+    const int64_t nrow = rows[nthreads];
+
+    Map out(path, HEADER + sizeof(float) * nrow * ncol);
+    std::memset(out.Data(), 0, HEADER);
+    std::memcpy(out.Data(), MAGIC, sizeof(MAGIC));
+    std::memcpy(out.Data() + 8, &nrow, sizeof(int64_t));
+    std::memcpy(out.Data() + 16, &ncol, sizeof(int64_t));
+    auto cols = reinterpret_cast<float*>(out.Data() + HEADER);
+
+    std::atomic<int64_t> bad{-1};
+    parallel([&]( int t )
+    {
+      int64_t r = rows[t];
+      for (const char* p = cuts[t]; p < cuts[t+1]; )
+      {
+        auto q = eol(p);
+        if (!blank(p, q))
+        {
+          if (std::count(p, q, ',') + 1 != ncol)
+            bad = r;
+          const char* f = p;
+          for (int64_t j = 0; j < ncol; j++)
+            cols[j * nrow + r] = field(f, q);
+          r++;
+        }
+        p = q + 1;
+      }
+    });
+
+    TORCH_CHECK( bad < 0, csv.string(), ": data row ", bad.load(),
+                 " does not have ", ncol, " columns." );
+    return nrow;
+  }
+
+  // Predictive mean of the rows of a table whose target (last column) is
+  // NaN, given the rest of the rows. Returns the row indices [m] (int64, a
+  // float is not exact above 2^24 rows) and their means [m].
+  template<class MODEL>
+  std::pair<torch::Tensor,torch::Tensor> Predict( MODEL& model,
+                                                  const Table& table )
+  {
+    TORCH_CHECK( table.Cols() >= 2, "Tables need features and a target." );
+    auto X = table.Columns(0, table.Cols() - 1);
+    auto y = table.Column(table.Cols() - 1);
+
+    auto query = torch::isnan(y.view(-1));
+    auto trn = (~query).nonzero().view(-1);
+    auto tst = query.nonzero().view(-1);
+    TORCH_CHECK( trn.numel() > 0 && tst.numel() > 0,
+                 "Need both labelled rows and query (NaN target) rows." );
+
+    torch::NoGradGuard nograd;
+    model->to(DEVICE);
+    model->eval();
+    auto mean = model( X.index_select(0, trn).to(DEVICE),
+                       y.index_select(0, trn).to(DEVICE),
+                       X.index_select(0, tst).to(DEVICE), c10::nullopt );
+    return { tst, mean.view(-1).to(torch::kCPU, torch::kFloat) };
+  }
+}
@@ -6,14 +6,30 @@
 #include <torch/torch.h>
 #include <filesystem>
 #include <limits>
+#include <map>
 #include <iostream>
 #include <typeinfo>
 #include "utils.h"
 /* const torch::Device DEVICE = select_device(); */
 #include "riemann.h"
+#include "preprocess.h"
 #include "prior.h"
+#include "compose.h"
 #include "model.h"
+#include "ensemble.h"
+#include "context.h"
+#include "retrieval.h"
+#include "bench.h"
+#include "runtime.h"
+#include "mem.h"
+#include "sched.h"
+#include "ckpt.h"
+#include "metrics.h"
 #include "train.h"
+#include "tune.h"
+#include "io.h"
+#include "serve.h"
+#include "sweep.h"
 
 
 #ifndef PRINT_  
@@ -40,6 +56,51 @@ int main(int argc, char** argv)
   conf.Register<size_t>("nset", 20);           
   conf.Register<size_t>("checks", 20);           
   conf.Register<fs::path>("path", "./simple");           
+  conf.Register<bool>("hier", false);           
+  conf.Register<std::string>("bench", "");           
+  conf.Register<int>("intra", 0);           
+  conf.Register<int>("inter", 0);           
+  conf.Register<int>("numa", -1);           
+  conf.Register<std::string>("cores", "");           
+  // the sampler thread and this one draw from the same global generator in
+  // an order that depends on the timing, so with --sampcores runs are not
+  // reproducible from --seed
+  conf.Register<std::string>("sampcores", "");           
+  conf.Register<size_t>("micro", 0);           
+  conf.Register<bool>("autotune", false);           
+  conf.Register<fs::path>("tunecache", "autotune.cache");           
+  conf.Register<double>("mem-budget", 0.);           
+  conf.Register<bool>("arena", false);           
+  conf.Register<bool>("allocs", false);           
+  conf.Register<bool>("varfeat", false);           
+  conf.Register<fs::path>("distill", "");           
+  conf.Register<std::string>("students", "64:2");           
+  conf.Register<double>("alpha", 0.5);           
+  conf.Register<fs::path>("csv", "");           
+  conf.Register<fs::path>("input", "");           
+  conf.Register<fs::path>("output", "pred.pfnt");           
+  conf.Register<bool>("prep", false);           
+  conf.Register<size_t>("validate", 0);           
+  conf.Register<size_t>("valsets", 4);           
+  conf.Register<std::string>("valcores", "");           
+  conf.Register<std::string>("sweep", "");           
+  conf.Register<std::string>("search", "grid");           
+  conf.Register<size_t>("trials", 0);           
+  conf.Register<size_t>("slots", 1);           
+  conf.Register<size_t>("killafter", 50);           
+  conf.Register<fs::path>("log", "");           
+  conf.Register<fs::path>("borders", "");           
+  conf.Register<std::string>("sched", "constant");           
+  conf.Register<size_t>("warmup", 0);           
+  conf.Register<double>("minlr", 0.);           
+  conf.Register<size_t>("curriculum", 0);           
+  conf.Register<size_t>("nsamp0", 0);           
+  conf.Register<size_t>("nset0", 0);           
+  conf.Register<double>("target", 0.);           
+  conf.Register<fs::path>("metrics", "");           
+  conf.Register<double>("metricsevery", 10.);           
+  conf.Register<int>("nshare", 1);           
+  conf.Register<std::string>("prior", "linear");           
 
   // -------------------------
   // Parse command line
@@ -57,28 +118,376 @@ int main(int argc, char** argv)
   // -------------------------
   conf.Print();
 
+  // -------------------------
+  // Threads, cores and memory placement
+  // -------------------------
+  runtime::Configure(conf);
+
+  // Count the (CPU) allocations of each step
+  if (conf.Get<bool>("allocs"))
+    mem::Tracker::GetInstance().Install();
+
   // -------------------------
   // Create the path
   // -------------------------
   torch::manual_seed(seed);
 
+  if (conf.Get<std::string>("bench") == "heads")
+  {
+    bench::Heads();
+    return 0;
+  }
+
+  // --prior mix: linear, GP and warped MLP functions in one batch
+  namespace pc = prior::compose;
+  using Mix = pc::Mixture<pc::Linear, pc::GP, pc::Warped<pc::Power,pc::MLP>>;
+  auto linear = prior::LinearTasks(0, 1, 1);
+  auto mix = prior::erase(pc::Prior<pc::Normal, Mix, pc::Gaussian>({}, {},
+                                                                   {0.1}));
+  const sweep::Priors priors = {{"linear", &linear}, {"mix", &mix}};
+  TORCH_CHECK( priors.count(conf.Get<std::string>("prior")),
+               "Unknown prior ", conf.Get<std::string>("prior") );
+  prior::Tasks& pr = *priors.at(conf.Get<std::string>("prior"));
+
+  // a mixture should cost about the average of its parts, not their sum
+  if (conf.Get<std::string>("bench") == "prior")
+  {
+    auto lin = prior::erase(pc::Prior<pc::Normal, pc::Linear, pc::Gaussian>(
+                              {}, {}, {0.1}));
+    auto gp = prior::erase(pc::Prior<pc::Normal, pc::GP, pc::Gaussian>(
+                             {}, {}, {0.1}));
+    auto mlp = prior::erase(pc::Prior<pc::Normal,
+                                      pc::Warped<pc::Power,pc::MLP>,
+                                      pc::Gaussian>({}, {}, {0.1}));
+    bench::Prior({{"LinearTasks", &linear}, {"linear", &lin}, {"gp", &gp},
+                  {"warped mlp", &mlp}, {"mixture", &mix}},
+                 conf.Get<size_t>("nset"), conf.Get<size_t>("nsamp"),
+                 conf.Get<size_t>("nfeat"));
+    return 0;
+  }
+
+  if (!conf.Get<std::string>("sweep").empty())
+    return sweep::Run(argc, argv, priors, conf);
+
+  // --metrics prefix: <prefix>.prom and <prefix>.jsonl every few seconds
+  if (!conf.Get<fs::path>("metrics").empty())
+    metrics::Registry::GetInstance().Start(conf.Get<fs::path>("metrics"),
+                                           conf.Get<double>("metricsevery"));
 
-  auto pr = prior::LinearTasks(0, 1, 1);
+  // A model of the configured architecture that is going to be loaded from
+  // a checkpoint anyway, the borders come with it so the prior is not
+  // sampled for them
+  auto shell = [&]( )
+  {
+    return model::SimplePFN(torch::linspace(0, 1, conf.Get<size_t>("nbin")+1),
+                            256, 4, 4, 512, conf.Get<size_t>("nfeat"),
+                            conf.Get<bool>("hier"), conf.Get<bool>("prep"),
+                            conf.Get<int>("nshare"));
+  };
+
+  auto make = [&]( )
+  {
+    // nfeat is the widest table the model takes, narrower ones are padded.
+    // The borders come from --borders if there is such a file.
+    auto file = conf.Get<fs::path>("borders");
+    if (!file.empty() && fs::exists(file))
+    {
+      torch::Tensor borders;
+      torch::load(borders, file.string());
+      return model::SimplePFN(borders, 256, 4, 4, 512,
+                              conf.Get<size_t>("nfeat"),
+                              conf.Get<bool>("hier"), conf.Get<bool>("prep"),
+                              conf.Get<int>("nshare"));
+    }
+    auto pfn = model::SimplePFN(pr, conf.Get<size_t>("nsamp"), 256, 4, 4, 512,
+                                conf.Get<size_t>("nfeat"),
+                                conf.Get<size_t>("nbin"),
+                                conf.Get<bool>("hier"), conf.Get<bool>("prep"),
+                                conf.Get<int>("nshare"));
+    if (!file.empty())
+      torch::save(pfn->loss->bins_, file.string());
+    return pfn;
+  };
+
+  if (conf.Get<std::string>("bench") == "tied")
+  {
+    bench::Tied(4, conf.Get<size_t>("nsamp"), conf.Get<size_t>("nset"));
+    return 0;
+  }
+
+  if (conf.Get<std::string>("bench") == "width")
+  {
+    auto pfn = make();
+    bench::Width(pfn, conf.Get<size_t>("nsamp"), conf.Get<size_t>("nset"));
+    return 0;
+  }
+
+  if (conf.Get<std::string>("bench") == "mem")
+  {
+    mem::Tracker::GetInstance().Install();
+    auto pfn = make();
+    mem::Check(pr, pfn, conf);
+    return 0;
+  }
+
+  // Cold start of the checkpoint --path, with and without the registry
+  if (conf.Get<std::string>("bench") == "registry")
+  {
+    serve::Check(conf.Get<fs::path>("path"), [&]
+    {
+      return model::SimplePFN(torch::linspace(0, 1,
+                                              conf.Get<size_t>("nbin") + 1),
+                              256, 4, 4, 512, conf.Get<size_t>("nfeat"),
+                              conf.Get<bool>("hier"), conf.Get<bool>("prep"),
+                              conf.Get<int>("nshare"));
+    });
+    return 0;
+  }
+
+  // Convert --csv into the binary table --input
+  if (!conf.Get<fs::path>("csv").empty())
+  {
+    TORCH_CHECK( !conf.Get<fs::path>("input").empty(),
+                 "Give the table to convert the CSV into with --input." );
+    auto nrow = io::csv_to_table(conf.Get<fs::path>("csv"),
+                                 conf.Get<fs::path>("input"));
+    PFN_LOG("Converted " << nrow << " rows into "
+            << conf.Get<fs::path>("input"));
+  }
+
+  // Predict the NaN targets of --input with the checkpoint --path, the
+  // result goes to the binary table --output: one column, row r is the
+  // prediction for row r of the input (NaN for the labelled rows), so no
+  // row index has to go through a float
+  if (!conf.Get<fs::path>("input").empty())
+  {
+    auto pfn = shell();
+    TORCH_CHECK( load_weights(conf.Get<fs::path>("path"), pfn),
+                 "Could not load the model ", conf.Get<fs::path>("path") );
+    io::Table table(conf.Get<fs::path>("input"));
+    auto [rows, mean] = io::Predict(pfn, table);
+    auto pred = torch::full({table.Rows()},
+                            std::numeric_limits<float>::quiet_NaN());
+    pred.index_copy_(0, rows, mean);
+    io::save_table(conf.Get<fs::path>("output"), pred);
+    return 0;
+  }
+
+  // Distill the teacher checkpoint into students of dmodel:nencoder each
+  if (!conf.Get<fs::path>("distill").empty())
+  {
+    auto teacher = shell();
+    TORCH_CHECK( load_weights(conf.Get<fs::path>("distill"), teacher),
+                 "Could not load the teacher ", conf.Get<fs::path>("distill") );
+
+    std::vector<std::string> names = {"teacher"};
+    std::vector<model::SimplePFN> models = {teacher};
+    std::stringstream list(conf.Get<std::string>("students"));
+    std::string spec;
+    while (std::getline(list, spec, ','))
+    {
+      auto colon = spec.find(':');
+      TORCH_CHECK( colon != std::string::npos,
+                   "Students are given as dmodel:nencoder, not ", spec );
+      int dmodel = std::stoi(spec.substr(0, colon));
+      int nencoder = std::stoi(spec.substr(colon + 1));
+
+      auto student = model::SimplePFN(teacher->loss->bins_, dmodel, 4,
+                                      nencoder, 2 * dmodel,
+                                      conf.Get<size_t>("nfeat"), false,
+                                      teacher->prep_);
+      auto name = std::to_string(dmodel) + "x" + std::to_string(nencoder);
+      auto path = conf.Get<fs::path>("path") / ("student_" + name);
+      fs::create_directories(path);
+
+      torch::optim::AdamW opt(student->parameters(),
+                              torch::optim::AdamWOptions(lr));
+      train::Distill(pr, teacher, student, opt, conf, path);
+      names.push_back(name);
+      models.push_back(student);
+    }
+    train::Tradeoff(pr, names, models, conf);
+    return 0;
+  }
+
+  // Wall time to --target validation loss, the given schedule against a
+  // constant learning rate on the full size from the first step
+  if (conf.Get<std::string>("bench") == "sched")
+  {
+    TORCH_CHECK( conf.Get<size_t>("validate") > 0 &&
+                 conf.Get<double>("target") > 0.,
+                 "The schedule benchmark needs --validate and --target." );
+    const auto total = conf.Get<int>("epochs");
+    sched::Schedule given(conf, total);
+    conf.Set<std::string>("sched", "constant");
+    conf.Set<size_t>("warmup", 0);
+    conf.Set<size_t>("curriculum", 0);
+    sched::Schedule baseline(conf, total);
+
+    const auto root = conf.Get<fs::path>("path");
+    std::vector<std::pair<std::string,train::Summary>> res;
+    for (auto& [name, schedule] : {std::make_pair("constant", &baseline),
+                                   std::make_pair("scheduled", &given)})
+    {
+      torch::manual_seed(seed);
+      conf.Set<fs::path>("path", root / (std::string("bench-") + name));
+      fs::create_directories(conf.Get<fs::path>("path"));
+      auto pfn = make();
+      torch::optim::AdamW opt(pfn->parameters(),
+                              torch::optim::AdamWOptions(lr));
+      res.emplace_back(name, train::Simple(pr, pfn, opt, conf, *schedule));
+    }
+
+    std::cout << std::string(64, '-') << "\n" << std::left
+              << std::setw(12) << "schedule"
+              << std::setw(12) << "total [s]"
+              << std::setw(12) << "best"
+              << std::setw(14) << "target [s]"
+              << std::setw(14) << "target step" << "\n"
+              << std::string(64, '-') << "\n";
+    for (const auto& [name, sum] : res)
+      std::cout << std::left << std::fixed << std::setprecision(3)
+                << std::setw(12) << name
+                << std::setw(12) << sum.seconds
+                << std::setw(12) << sum.best
+                << std::setw(14) << sum.reach
+                << std::setw(14) << sum.reachstep << "\n";
+    std::cout << std::string(64, '-') << "\n";
+    return 0;
+  }
+
+  // --epochs steps straight through against half of them, a resume from
+  // the checkpoint and the rest. The losses have to be the same.
+  if (conf.Get<std::string>("bench") == "resume")
+  {
+    const auto total = conf.Get<int>("epochs");
+    TORCH_CHECK( total >= 4, "The resume check needs --epochs 4 or more." );
+    const int half = total / 2;
+    const auto root = conf.Get<fs::path>("path");
+    conf.Set<std::string>("sampcores", "");   // prefetching is not exact
+    conf.Set<size_t>("validate", 0);
+    sched::Schedule schedule(conf, total);
+
+    // a fresh <root>/resume-<name> that Simple logs its losses into
+    auto start = [&]( const std::string& name )
+    {
+      conf.Set<fs::path>("path", root / ("resume-" + name));
+      fs::remove_all(conf.Get<fs::path>("path"));
+      fs::create_directories(conf.Get<fs::path>("path"));
+      conf.Set<fs::path>("log", conf.Get<fs::path>("path") / "progress.txt");
+    };
+    auto losses = [&]( )
+    {
+      std::map<int,double> res;
+      std::ifstream file(conf.Get<fs::path>("log"));
+      int step;
+      double loss, seconds;
+      while (file >> step >> loss >> seconds)
+        res[step] = loss;
+      return res;
+    };
+
+    // Simple runs the steps [epoch_, epoch_ + epochs]
+    torch::manual_seed(seed);
+    start("straight");
+    {
+      auto pfn = shell();
+      torch::optim::AdamW opt(pfn->parameters(),
+                              torch::optim::AdamWOptions(lr));
+      conf.Set<int>("epochs", total - 1);
+      train::Simple(pr, pfn, opt, conf, schedule);
+    }
+    auto straight = losses();
+
+    torch::manual_seed(seed);
+    start("resumed");
+    {
+      auto pfn = shell();
+      torch::optim::AdamW opt(pfn->parameters(),
+                              torch::optim::AdamWOptions(lr));
+      conf.Set<int>("epochs", half - 1);
+      train::Simple(pr, pfn, opt, conf, schedule, 0, half - 1);
+    }
+    {
+      auto pfn = shell();
+      pfn->to(DEVICE);
+      torch::optim::AdamW opt(pfn->parameters(),
+                              torch::optim::AdamWOptions(lr));
+      // no steps at all, only the checkpoint can make it right
+      sched::Schedule restored(conf, 0);
+      auto next = ckpt::Load(conf.Get<fs::path>("path") /
+                             ("epoch_" + std::to_string(half - 1) + ".pt"),
+                             pfn, opt, restored, conf);
+      TORCH_CHECK( next == half, "Resuming at step ", next, " instead of ",
+                   half );
+      for (int step = next; step < total; step++)
+        TORCH_CHECK( restored.LR(step) == schedule.LR(step) &&
+                     restored.Nsamp(step) == schedule.Nsamp(step) &&
+                     restored.Nset(step) == schedule.Nset(step),
+                     "The restored schedule differs at step ", step );
+      conf.Set<int>("epochs", total - half - 1);
+      train::Simple(pr, pfn, opt, conf, restored, next);
+    }
+    auto resumed = losses();
+
+    double worst = 0.;
+    std::cout << "\n" << std::string(52, '-') << "\n" << std::left
+              << std::setw(8) << "step"
+              << std::setw(16) << "straight"
+              << std::setw(16) << "resumed"
+              << std::setw(12) << "diff" << "\n"
+              << std::string(52, '-') << "\n";
+    for (int step = 0; step < total; step++)
+    {
+      TORCH_CHECK( straight.count(step) && resumed.count(step),
+                   "No loss logged for step ", step );
+      const double diff = std::abs(straight[step] - resumed[step]);
+      worst = std::max(worst, diff);
+      std::cout << std::left << std::fixed << std::setprecision(6)
+                << std::setw(8) << step
+                << std::setw(16) << straight[step]
+                << std::setw(16) << resumed[step]
+                << std::setw(12) << std::scientific << diff << std::fixed
+                << "\n";
+    }
+    std::cout << std::string(52, '-') << "\n"
+              << "Largest difference: " << std::scientific << worst
+              << (worst == 0. ? " (exact)" : " (NOT exact)") << "\n";
+    return worst == 0. ? 0 : 1;
+  }
 
   if (!is_regular_file(conf.Get<fs::path>("path")))
   {
     fs::create_directories(conf.Get<fs::path>("path"));
-    model::SimplePFN pfn(pr, conf.Get<size_t>("nsamp"));
+    auto pfn = make();
+    if (conf.Get<bool>("autotune"))
+      tune::Autotune(pr, pfn, conf);
+    mem::Budget(pfn, conf);
     torch::optim::AdamW opt(pfn->parameters(),torch::optim::AdamWOptions(lr));
-    train::Simple(pr, pfn, opt, conf);
+    sched::Schedule schedule(conf, conf.Get<int>("epochs"));
+    schedule.Print();
+    train::Simple(pr, pfn, opt, conf, schedule);
   }
   else
   {
-    model::SimplePFN pfn(pr, conf.Get<size_t>("nsamp"));
-    auto epoch = load_checkpoint(conf.Get<fs::path>("path"), pfn);
-    conf.Set<fs::path>("path",conf.Get<fs::path>("path").remove_filename());
+    // no need to sample the prior for the borders, they are in the
+    // checkpoint together with the rest of the training state
+    auto pfn = model::SimplePFN(torch::linspace(0, 1, conf.Get<size_t>("nbin")+1),
+                                256, 4, 4, 512, conf.Get<size_t>("nfeat"),
+                                conf.Get<bool>("hier"), conf.Get<bool>("prep"),
+                                conf.Get<int>("nshare"));
+    pfn->to(DEVICE);
     torch::optim::AdamW opt(pfn->parameters(),torch::optim::AdamWOptions(lr));
-    train::Simple( pr, pfn, opt, conf, epoch );
+    sched::Schedule schedule(conf, conf.Get<int>("epochs"));
+    auto epoch = ckpt::Load(conf.Get<fs::path>("path"), pfn, opt, schedule,
+                            conf);
+    schedule.Print();
+
+    conf.Set<fs::path>("path",conf.Get<fs::path>("path").remove_filename());
+    if (conf.Get<bool>("autotune"))
+      tune::Autotune(pr, pfn, conf);
+    mem::Budget(pfn, conf);
+    train::Simple( pr, pfn, opt, conf, schedule, epoch );
   }
 
   /* torch::save(pfn,"pfn.pt"); */
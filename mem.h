@@ -0,0 +1,217 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: How much memory is a training step of SimplePFN going to
+  * take? An analytical model (Estimate), a tracking CPU allocator to check it
+  * against (Tracker) and a planner that clamps the micro-batch to a budget
+  * (--mem-budget in MB).
+  *
+*/
+#pragma once
+#include <atomic>
+#include <iomanip>
+#include <torch/version.h>
+
+namespace mem
+{
+  // Bytes of a training step, everything is float32
+  struct Usage
+  {
+    double weights = 0, grads = 0, optim = 0;  // model and AdamW state
+    double mask = 0, embed = 0;                // attention mask, embeddings
+    double layers = 0, scores = 0;             // per layer activations
+    double logits = 0;                         // Riemann logits
+
+    double Total( ) const
+    {
+      return weights + grads + optim + mask + embed + layers + scores + logits;
+    }
+
+    void Print( std::ostream& out = std::cout ) const
+    {
+      auto mb = [](double b) { return b / (1024. * 1024.); };
+      out << std::fixed << std::setprecision(1)
+          << "weights " << mb(weights) << " MB, grads " << mb(grads)
+          << " MB, optim " << mb(optim) << " MB, mask " << mb(mask)
+          << " MB, embed " << mb(embed) << " MB, layers " << mb(layers)
+          << " MB, scores " << mb(scores) << " MB, logits " << mb(logits)
+          << " MB -> total " << mb(Total()) << " MB" << std::endl;
+    }
+  };
+
+  // b datasets of S samples each (a test set as large as the sequence is
+  // assumed, which is the worst case of the random split)
+  template<class MODEL>
+  Usage Estimate( const MODEL& model, int64_t b, int64_t S )
+  {
+    const double f = sizeof(float);
+    const double d = model->dmodel_, H = model->nhead_, L = model->nencoder_;
+    const double hid = model->nhid_, nbin = model->nbin_;
+    const double P = nparams(*model);
+
+    Usage u;
+    u.weights = f * P;
+    u.grads = f * P;
+    u.optim = 2. * f * P;                  // exp_avg and exp_avg_sq
+    u.mask = f * S * S;                    // one float mask, kept by the model
+    u.embed = f * S * b * (d + model->infeat_ + 2.); // fused tokens + features
+    // saved for backward in each layer: input, q/k/v, attention output and
+    // its projection, 2 norms, residuals (~9 d) + linear1 and relu (2 hid)
+    u.layers = L * f * S * b * (9. * d + 2. * hid);
+    // scores before and after softmax per head + the averaged weights
+    u.scores = L * f * b * S * S * (2. * H + 1.);
+    // logits, log_softmax and their gradient
+    u.logits = 3. * f * S * b * (model->hier_ ? 2. * std::sqrt(nbin) : nbin);
+    return u;
+  }
+
+  //---------------------------------------------------------------------------
+  // Tracker : CPU allocator that counts allocations and live/peak bytes on
+  // top of the default one. Install it before the allocations you want to see.
+  //---------------------------------------------------------------------------
+  class Tracker final : public c10::Allocator
+  {
+  public:
+    static Tracker& GetInstance( )
+    {
+      static Tracker instance;
+      return instance;
+    }
+
+    void Install( )
+    {
+      if (base_ != nullptr)
+        return;
+      base_ = c10::GetCPUAllocator();
+      c10::SetCPUAllocator(this);
+    }
+
+    bool Installed( ) const { return base_ != nullptr; }
+
+#if TORCH_VERSION_MAJOR > 2 || \
+    (TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR >= 3)
+    c10::DataPtr allocate( size_t n ) override { return _Allocate(n); }
+
+    void copy_data( void* dest, const void* src,
+                    std::size_t count ) const override
+    {
+      default_copy_data(dest, src, count);
+    }
+#else
+    c10::DataPtr allocate( size_t n ) const override { return _Allocate(n); }
+#endif
+
+    size_t Count( ) const { return count_; }
+    size_t Bytes( ) const { return bytes_; }
+    size_t Peak( ) const { return peak_; }
+    void ResetPeak( ) { peak_ = bytes_.load(); }
+
+  private:
+    struct Block
+    {
+      c10::DataPtr inner;
+      size_t n;
+    };
+
+    c10::Allocator* base_ = nullptr;
+    mutable std::atomic<size_t> count_{0}, bytes_{0}, peak_{0};
+
+    Tracker( ) = default;
+
+    c10::DataPtr _Allocate( size_t n ) const
+    {
+      auto inner = base_->allocate(n);
+      void* data = inner.get();
+      auto device = inner.device();
+
+      count_++;
+      auto now = (bytes_ += n);
+      auto peak = peak_.load();
+      while (now > peak && !peak_.compare_exchange_weak(peak, now)) { }
+
+      return c10::DataPtr(data, new Block{std::move(inner), n},
+                          &Tracker::_Free, device);
+    }
+
+    static void _Free( void* ctx )
+    {
+      auto block = static_cast<Block*>(ctx);
+      GetInstance().bytes_ -= block->n;
+      delete block;
+    }
+  };
+
+  // Largest micro-batch (<= nset) whose estimate fits in the budget (bytes)
+  template<class MODEL>
+  size_t Plan( const MODEL& model, size_t nset, size_t nsamp, double budget )
+  {
+    size_t micro = nset;
+    while (micro > 0 && Estimate(model, micro, nsamp).Total() > budget)
+      micro--;
+
+    if (micro == 0)
+    {
+      Estimate(model, 1, nsamp).Print();
+      TORCH_CHECK( false, "A single dataset does not fit in --mem-budget." );
+    }
+    return micro;
+  }
+
+  // Clamp --micro to what --mem-budget allows, accumulation takes the rest
+  template<class MODEL>
+  void Budget( const MODEL& model, CLIStore& conf )
+  {
+    auto budget = conf.Get<double>("mem-budget") * 1024. * 1024.;
+    if (budget <= 0.)
+      return;
+
+    auto nset = conf.Get<size_t>("nset");
+    auto micro = conf.Get<size_t>("micro");
+    micro = std::min(micro == 0 ? nset : micro,
+                     Plan(model, nset, conf.Get<size_t>("nsamp"), budget));
+    conf.Set<size_t>("micro", micro);
+
+    PFN_LOG("Memory budget: micro-batch " << micro << " of " << nset);
+    Estimate(model, micro, conf.Get<size_t>("nsamp")).Print();
+  }
+
+  // Estimated vs measured (peak of the tracking allocator) for a few sizes
+  template<class PRIOR, class MODEL>
+  void Check( const PRIOR& prior, MODEL& model, const CLIStore& conf,
+              std::ostream& out = std::cout )
+  {
+    auto& tracker = Tracker::GetInstance();
+    TORCH_CHECK( tracker.Installed() && !DEVICE.is_cuda(),
+                 "Memory check needs the tracker on the CPU." );
+
+    const auto nsamp = conf.Get<size_t>("nsamp");
+
+    out << std::string(50, '-') << "\n" << std::left
+        << std::setw(10) << "nset"
+        << std::setw(20) << "estimate [MB]"
+        << std::setw(20) << "measured [MB]" << "\n"
+        << std::string(50, '-') << "\n";
+
+    for (size_t nset : {1, 4, 16})
+    {
+      // start every size with only the weights alive
+      model->zero_grad();
+      tracker.ResetPeak();
+      auto base = tracker.Bytes();
+      torch::optim::AdamW opt(model->parameters());
+
+      auto sets = split( prior.Sample(nset, nsamp, conf.Get<size_t>("nfeat")),
+                         nsamp - 1 );
+      model( std::get<0>(sets), std::get<2>(sets),
+             std::get<1>(sets), std::get<3>(sets) ).backward();
+      opt.step();
+
+      // the weights were there before we started
+      double measured = tracker.Peak() - base + 4. * nparams(*model);
+      out << std::setw(10) << nset << std::fixed << std::setprecision(1)
+          << std::setw(20) << Estimate(model, nset, nsamp).Total() / 1048576.
+          << std::setw(20) << measured / 1048576. << "\n";
+    }
+    out << std::string(50, '-') << "\n";
+  }
+}
@@ -0,0 +1,351 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Metrics of long running processes: counters, gauges and
+  * histograms in a registry that is dumped every few seconds to
+  *   <prefix>.prom   Prometheus text format (node exporter textfile style)
+  *   <prefix>.jsonl  one JSON object per dump
+  *
+  * Counters and histograms are accumulated per thread, every thread writes
+  * only its own slots (relaxed atomics, no contention), the dumper sums
+  * them. Gauges are a single relaxed store. Callback gauges are evaluated
+  * at dump time, for things like queue depths and allocator bytes.
+  *
+  *   auto& reg = metrics::Registry::GetInstance();
+  *   auto steps = reg.MakeCounter("pfn_steps_total", "Training steps");
+  *   steps.Add(1);
+*/
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace metrics
+{
+  class Registry;
+
+  // Accumulators of one thread
+  struct Shard
+  {
+    static constexpr size_t SIZE = 1024;
+    std::array<std::atomic<double>, SIZE> slots{};
+
+    void Add( size_t i, double v )
+    {
+      slots[i].store(slots[i].load(std::memory_order_relaxed) + v,
+                     std::memory_order_relaxed);
+    }
+  };
+
+  class Counter
+  {
+  public:
+    void Add( double v = 1. ) const;
+  private:
+    friend class Registry;
+    explicit Counter( size_t slot ) : slot_(slot) { }
+    size_t slot_;
+  };
+
+  class Gauge
+  {
+  public:
+    void Set( double v ) const { value_->store(v, std::memory_order_relaxed); }
+  private:
+    friend class Registry;
+    explicit Gauge( std::atomic<double>* value ) : value_(value) { }
+    std::atomic<double>* value_;
+  };
+
+  // Buckets (upper bounds) + sum + count, in consecutive slots
+  class Histogram
+  {
+  public:
+    void Observe( double v ) const;
+  private:
+    friend class Registry;
+    Histogram( size_t slot, const std::vector<double>* bounds ) :
+      slot_(slot), bounds_(bounds) { }
+    size_t slot_;
+    const std::vector<double>* bounds_;
+  };
+
+  // Exponential bounds, e.g. for latencies in seconds
+  std::vector<double> exp_bounds( double first = 1e-4, double factor = 2.,
+                                  int n = 20 )
+  {
+    std::vector<double> res;
+    for (int i = 0; i < n; i++, first *= factor)
+      res.push_back(first);
+    return res;
+  }
+
+  class Registry
+  {
+  public:
+    static Registry& GetInstance( )
+    {
+      static Registry instance;
+      return instance;
+    }
+
+    ~Registry( ) { Stop(); }
+
+    // labels like: phase="data"
+    Counter MakeCounter( const std::string& name, const std::string& help,
+                         const std::string& labels = "" )
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& m = _Make(name, help, labels, "counter", 1);
+      return Counter(m.slot);
+    }
+
+    Gauge MakeGauge( const std::string& name, const std::string& help,
+                     const std::string& labels = "" )
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& m = _Make(name, help, labels, "gauge", 0);
+      m.gauge = std::make_unique<std::atomic<double>>(0.);
+      return Gauge(m.gauge.get());
+    }
+
+    void MakeCallback( const std::string& name, const std::string& help,
+                       std::function<double()> fn,
+                       const std::string& labels = "" )
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      _Make(name, help, labels, "gauge", 0).fn = std::move(fn);
+    }
+
+    Histogram MakeHistogram( const std::string& name, const std::string& help,
+                             const std::vector<double>& bounds = exp_bounds(),
+                             const std::string& labels = "" )
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& m = _Make(name, help, labels, "histogram", bounds.size() + 3);
+      m.bounds = std::make_unique<std::vector<double>>(bounds);
+      return Histogram(m.slot, m.bounds.get());
+    }
+
+    // The accumulators of the calling thread
+    Shard& Local( )
+    {
+      thread_local std::shared_ptr<Shard> shard = _NewShard();
+      return *shard;
+    }
+
+    void Write( std::ostream& prom, std::ostream& jsonl )
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<double> sums(next_, 0.);
+      for (const auto& s : shards_)
+        for (size_t i = 0; i < next_; i++)
+          sums[i] += s->slots[i].load(std::memory_order_relaxed);
+
+      auto full = []( const std::string& name, const std::string& labels )
+      {
+        return labels.empty() ? name : name + "{" + labels + "}";
+      };
+      auto join = []( const std::string& labels, const std::string& more )
+      {
+        return labels.empty() ? more : labels + "," + more;
+      };
+
+      auto now = std::chrono::duration<double>(
+          std::chrono::system_clock::now().time_since_epoch()).count();
+      jsonl << std::setprecision(15) << "{\"time\": " << now;
+      prom << std::setprecision(10);
+
+      std::string last;
+      for (const auto& m : metrics_)
+      {
+        if (m.name != last)
+          prom << "# HELP " << m.name << " " << m.help << "\n"
+               << "# TYPE " << m.name << " " << m.type << "\n";
+        last = m.name;
+
+        if (m.type == "histogram")
+        {
+          const auto& b = *m.bounds;
+          double cum = 0.;
+          for (size_t i = 0; i <= b.size(); i++)
+          {
+            cum += sums[m.slot + i];
+            auto le = i < b.size() ? std::to_string(b[i]) : "+Inf";
+            prom << full(m.name + "_bucket", join(m.labels,
+                                              "le=\"" + le + "\"")) << " "
+                 << cum << "\n";
+          }
+          auto sum = sums[m.slot + b.size() + 1];
+          auto count = sums[m.slot + b.size() + 2];
+          prom << full(m.name + "_sum", m.labels) << " " << sum << "\n"
+               << full(m.name + "_count", m.labels) << " " << count << "\n";
+          jsonl << ", \"" << _Escape(full(m.name + "_sum", m.labels)) << "\": "
+                << sum << ", \"" << _Escape(full(m.name + "_count", m.labels))
+                << "\": " << count;
+          continue;
+        }
+
+        double v = m.fn ? m.fn() :
+                   m.gauge ? m.gauge->load(std::memory_order_relaxed) :
+                   sums[m.slot];
+        prom << full(m.name, m.labels) << " " << v << "\n";
+        jsonl << ", \"" << _Escape(full(m.name, m.labels)) << "\": " << v;
+      }
+      jsonl << "}\n";
+    }
+
+    // Write <prefix>.prom (replaced) and <prefix>.jsonl (appended)
+    void Dump( const std::filesystem::path& prefix )
+    {
+      auto prom = prefix;
+      prom += ".prom";
+      auto tmp = prom;
+      tmp += ".tmp";
+      auto jsonl = prefix;
+      jsonl += ".jsonl";
+      {
+        std::ofstream p(tmp);
+        std::ofstream j(jsonl, std::ios::app);
+        Write(p, j);
+      }
+      std::filesystem::rename(tmp, prom); // scrapers never see half a file
+    }
+
+    // Dump every period seconds on a background thread (and once at Stop)
+    void Start( const std::filesystem::path& prefix, double period )
+    {
+      Stop();
+      prefix_ = prefix;
+      stop_ = false;
+      thread_ = std::thread([this, period]
+      {
+        std::unique_lock<std::mutex> lock(wait_);
+        while (!cv_.wait_for(lock, std::chrono::duration<double>(period),
+                             [this]{ return stop_; }))
+          Dump(prefix_);
+      });
+    }
+
+    void Stop( )
+    {
+      if (!thread_.joinable())
+        return;
+      {
+        std::lock_guard<std::mutex> lock(wait_);
+        stop_ = true;
+      }
+      cv_.notify_all();
+      thread_.join();
+      Dump(prefix_);
+    }
+
+  private:
+    struct Metric
+    {
+      std::string name, help, labels, type;
+      size_t slot = 0;
+      std::unique_ptr<std::atomic<double>> gauge;
+      std::unique_ptr<std::vector<double>> bounds;
+      std::function<double()> fn;
+    };
+
+    std::mutex mutex_;
+    std::vector<Metric> metrics_;
+    std::vector<std::shared_ptr<Shard>> shards_;
+    size_t next_ = 0;
+
+    std::filesystem::path prefix_;
+    std::mutex wait_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+
+    Registry( ) = default;
+
+    // Same names stay together so that HELP/TYPE are written once
+    Metric& _Make( const std::string& name, const std::string& help,
+                   const std::string& labels, const std::string& type,
+                   size_t nslot )
+    {
+      TORCH_CHECK( next_ + nslot <= Shard::SIZE, "Too many metrics." );
+      auto pos = metrics_.end();
+      for (auto it = metrics_.begin(); it != metrics_.end(); it++)
+        if (it->name == name)
+        {
+          TORCH_CHECK( it->type == type, "Metric ", name, " is a ", it->type );
+          TORCH_CHECK( it->labels != labels, "Metric ", name, "{", labels,
+                       "} exists already." );
+          pos = it + 1;
+        }
+      Metric m;
+      m.name = name; m.help = help; m.labels = labels; m.type = type;
+      m.slot = next_;
+      next_ += nslot;
+      return *metrics_.insert(pos, std::move(m));
+    }
+
+    std::shared_ptr<Shard> _NewShard( )
+    {
+      auto shard = std::make_shared<Shard>();
+      std::lock_guard<std::mutex> lock(mutex_);
+      shards_.push_back(shard);
+      return shard;
+    }
+
+    static std::string _Escape( const std::string& s )
+    {
+      std::string res;
+      for (char c : s)
+      {
+        if (c == '"' || c == '\\')
+          res += '\\';
+        res += c;
+      }
+      return res;
+    }
+  };
+
+  inline void Counter::Add( double v ) const
+  {
+    Registry::GetInstance().Local().Add(slot_, v);
+  }
+
+  inline void Histogram::Observe( double v ) const
+  {
+    auto& shard = Registry::GetInstance().Local();
+    const auto& b = *bounds_;
+    auto i = std::lower_bound(b.begin(), b.end(), v) - b.begin();
+    shard.Add(slot_ + i, 1.);
+    shard.Add(slot_ + b.size() + 1, v);
+    shard.Add(slot_ + b.size() + 2, 1.);
+  }
+
+  // Seconds since construction, observed into h at destruction
+  class Timer
+  {
+  public:
+    explicit Timer( const Histogram& h ) :
+      h_(h), t0_(std::chrono::high_resolution_clock::now()) { }
+    ~Timer( )
+    {
+      std::chrono::duration<double> dt =
+        std::chrono::high_resolution_clock::now() - t0_;
+      h_.Observe(dt.count());
+    }
+  private:
+    const Histogram& h_;
+    std::chrono::high_resolution_clock::time_point t0_;
+  };
+}
@@ -11,14 +11,16 @@ namespace model
 {
   struct SimplePFNImpl : torch::nn::Module
   {
-    int dmodel_, nhead_, nencoder_, nhid_, infeat_, nbin_, nsamp_;
-    prior::Tasks& pri_;
+    int dmodel_, nhead_, nencoder_, nhid_, infeat_, nbin_, nsamp_, nshare_;
+    bool hier_, prep_;
 
     torch::nn::TransformerEncoder encoder{nullptr};
     torch::nn::LayerNorm ln_between{nullptr};
     torch::nn::Linear decoder{nullptr}, embedx{nullptr}, embedy{nullptr};
     dist::Riemann loss = nullptr;
+    dist::HierRiemann hloss = nullptr;
 
+       // The borders are obtained from the prior
        SimplePFNImpl( prior::Tasks& pri,
                       const int nsamp, 
                       int dmodel=256,
@@ -26,14 +28,40 @@ namespace model
                       int nencoder=4,
                       int nhid=512,
                       int infeat=1,
-                      int nbin = 100 ) :  dmodel_(dmodel),
+                      int nbin = 100,
+                      bool hier = false,
+                      bool prep = false,
+                      int nshare = 1 ) : 
+         SimplePFNImpl( pri.Border(nsamp,infeat,nbin,prep), dmodel, nhead, 
+                        nencoder, nhid, infeat, hier, prep, nshare )
+    {
+      nsamp_ = nsamp;
+    }
+
+       // The borders are given, i.e. when you are going to load a checkpoint
+       // anyway there is no need to sample the prior.
+       //
+       // nshare consecutive layers use the same weights (ALBERT style,
+       // nshare = nencoder ties all of them). The depth stays nencoder, only
+       // ceil(nencoder/nshare) layers are stored and read.
+       SimplePFNImpl( const torch::Tensor& borders,
+                      int dmodel=256,
+                      int nhead=4,
+                      int nencoder=4,
+                      int nhid=512,
+                      int infeat=1,
+                      bool hier = false,
+                      bool prep = false,
+                      int nshare = 1 ) :  dmodel_(dmodel),
                                           nhead_(nhead),
                                           nencoder_(nencoder),
                                           nhid_(nhid),
                                           infeat_(infeat),
-                                          nbin_(nbin),
-                                          nsamp_(nsamp),
-                                          pri_(pri)
+                                          nbin_(borders.numel()-1),
+                                          nsamp_(0),
+                                          nshare_(nshare),
+                                          hier_(hier),
+                                          prep_(prep)
           
     {
       // Encoder layer
@@ -42,59 +70,172 @@ namespace model
               .dim_feedforward(nhid)
               .dropout(0.));
 
-      // Transformer encoder
+      // Transformer encoder, with only the distinct layers in it
+      TORCH_CHECK( nshare >= 1 && nshare <= nencoder,
+                   "nshare must be in [1, nencoder]." );
       encoder = register_module("encoder", torch::nn::TransformerEncoder(
-          torch::nn::TransformerEncoderOptions(encoder_layer, nencoder)
+          torch::nn::TransformerEncoderOptions(encoder_layer,
+                                               (nencoder + nshare - 1) / nshare)
       ));
 
       // LayerNorm between encoder and decoder
       ln_between = register_module("ln_between", torch::nn::LayerNorm(
         torch::nn::LayerNormOptions({dmodel})));
 
-      // Decoder
-      decoder = register_module("decoder", torch::nn::Linear(dmodel,nbin));
       embedx = register_module("ex",torch::nn::Linear(infeat,dmodel));
       embedy = register_module("ey",torch::nn::Linear(1,dmodel));
-      loss = register_module("loss", dist::Riemann(
-                                              pri_.Border(nsamp_,infeat,nbin)));
+      loss = register_module("loss", dist::Riemann(borders));
+
+      // Decoder, the two-level head brings its own projections
+      if (hier_)
+        hloss = register_module("hloss", dist::HierRiemann(loss->bins_,dmodel));
+      else
+        decoder = register_module("decoder", torch::nn::Linear(dmodel,nbin_));
 
-      std::cout << "SimplePFN parameter count: " << nparams(*this) << std::endl;
+      PFN_LOG("SimplePFN parameter count: " << nparams(*this));
     }
 
-    // This is helper for creating the attention mask
+    // This is helper for creating the attention mask, everyone sees the train
+    // part and the test part only sees itself. Built for every call, in the
+    // buffer of the caller's arena if there is one (never in the module, a
+    // model may run forwards on many threads at once).
     template<class O=double>
-    torch::Tensor att_mask ( int size, int tstsize )
+    torch::Tensor att_mask ( int size, int tstsize,
+                             const torch::TensorOptions& opts = {},
+                             Arena* arena = nullptr )
     {
-      using namespace torch::indexing;
+      auto mask = arena ? arena->Get("model.mask", {size,size}, opts).zero_()
+                        : torch::zeros({size,size}, opts);
       int trnsize =  size - tstsize;
-      auto mask = torch::zeros({size,size}) == 0.;
-      mask.index({Slice(0,None),Slice(trnsize,None)}).zero_();
-      mask |= torch::eye(size, mask.options()).eq(1);
-      mask = mask.toType(torch::kFloat).masked_fill(mask==0,
-                        -std::numeric_limits<float>::infinity());
-      return mask.masked_fill(mask==1,0.);
+      mask.narrow(1, trnsize, tstsize).fill_(
+                                      -std::numeric_limits<float>::infinity());
+      mask.diagonal().fill_(0.);
+      return mask;
     }
 
-    torch::Tensor forward( const torch::Tensor& Xtrn,
+    // Encoder layer at depth l in [0, nencoder_)
+    torch::nn::TransformerEncoderLayerImpl& layer( int l )
+    {
+      return *encoder->layers[l / nshare_]
+                ->as<torch::nn::TransformerEncoderLayer>();
+    }
+
+    // All nencoder_ layers, the shared ones are applied repeatedly
+    torch::Tensor encode( const torch::Tensor& src, const torch::Tensor& mask )
+    {
+      if (nshare_ == 1)
+        return encoder(src, mask);
+      auto h = src;
+      for (int l = 0; l < nencoder_; l++)
+        h = layer(l).forward(h, mask);
+      return h;
+    }
+
+    // Tokens of the whole sequence in one GEMM. Every row gets the features
+    // [x, y, is_train] (y and is_train are 0 for the test rows) and the
+    // weight is [Wx, Wy, by], so that a train row is embedx(x) + embedy(y)
+    // and a test row embedx(x), same as with the separate ex/ey layers.
+    //
+    // Tables narrower than infeat_ are treated as zero padded to infeat_
+    // columns and rescaled by sqrt(infeat_/nfeat), so that the tokens keep
+    // the scale of a full row. The padding never materializes, only the
+    // first nfeat columns of Wx are used.
+    //
+    // The features of the sequence are written into the buffer of the
+    // caller's arena if there is one, every part of it is written.
+    torch::Tensor embed( const torch::Tensor& Xtrn,
+                         const torch::Tensor& ytrn,
+                         const torch::Tensor& Xtst,
+                         Arena* arena = nullptr )
+    {
+      const auto ntrn = Xtrn.size(0), ntst = Xtst.size(0);
+      const auto nfeat = Xtrn.size(2);
+      TORCH_CHECK( nfeat > 0 && nfeat <= infeat_,
+                   "Number of features must be in [1, ", infeat_, "]." );
+      const std::vector<int64_t> shape = {ntrn+ntst, Xtrn.size(1), nfeat+2};
+      auto feats = arena ? arena->Get("model.feats", shape, Xtrn.options())
+                         : torch::empty(shape, Xtrn.options());
+      auto trn = feats.narrow(0, 0, ntrn), tst = feats.narrow(0, ntrn, ntst);
+      trn.narrow(2, 0, nfeat).copy_(Xtrn);
+      trn.narrow(2, nfeat, 1).copy_(ytrn);
+      trn.narrow(2, nfeat+1, 1).fill_(1.);
+      tst.narrow(2, 0, nfeat).copy_(Xtst);
+      tst.narrow(2, nfeat, 2).zero_();
+
+      auto wx = embedx->weight.narrow(1, 0, nfeat);
+      if (nfeat < infeat_)
+        wx = wx * std::sqrt(double(infeat_) / double(nfeat));
+
+      auto weight = torch::cat({wx, embedy->weight,
+                                embedy->bias.unsqueeze(1)}, 1);
+      return torch::nn::functional::linear(feats, weight, embedx->bias);
+    }
+
+    // Encoder output for the test part of the sequence, the inputs are
+    // taken as they are (preprocessed already if prep_). The per call
+    // buffers come from arena if it is given, it belongs to the caller.
+    torch::Tensor _hidden( const torch::Tensor& Xtrn,
                            const torch::Tensor& ytrn,
                            const torch::Tensor& Xtst,
-                           const c10::optional<torch::Tensor>& ytst )
-    { 
+                           Arena* arena = nullptr )
+    {
       using namespace torch::indexing;
-      auto train = embedx(Xtrn) + embedy(ytrn);
-      auto test = embedx(Xtst);
-      
-      auto src = torch::cat({train,test},0);
+      auto src = embed(Xtrn, ytrn, Xtst, arena);
       // I am doing this becase there is not batch first option here...
       /* src = src.permute({1, 0, 2}); */
-      auto mask = att_mask(Xtrn.size(0)+Xtst.size(0), Xtst.size(0));
-      mask = mask.to(DEVICE);
-      if (ytst.has_value())
-        return loss(decoder(encoder(src, mask)).
-          index({Slice(Xtrn.size(0), None), Slice(), Slice()}),ytst.value());
+      auto mask = att_mask(Xtrn.size(0)+Xtst.size(0), Xtst.size(0),
+                           src.options(), arena);
+      return encode(src, mask).
+          index({Slice(Xtrn.size(0), None), Slice(), Slice()});
+    }
+
+    // Encoder output for the test part of the sequence
+    torch::Tensor hidden( const torch::Tensor& Xtrn,
+                          const torch::Tensor& ytrn,
+                          const torch::Tensor& Xtst )
+    {
+      if (!prep_)
+        return _hidden(Xtrn, ytrn, Xtst);
+      auto s = prep::fit(Xtrn, ytrn);
+      return _hidden(prep::x(Xtrn,s), prep::y(ytrn,s), prep::x(Xtst,s));
+    }
+
+    // Decoder output (logits over the bins) for the test part of the
+    // sequence. With prep_ the bins are in the standardized target space of
+    // each dataset, see prep::invert.
+    torch::Tensor logits( const torch::Tensor& Xtrn,
+                          const torch::Tensor& ytrn,
+                          const torch::Tensor& Xtst )
+    {
+      TORCH_CHECK( !hier_, "The two-level head has no flat logits." );
+      return decoder(hidden(Xtrn, ytrn, Xtst));
+    }
+
+    // Loss if ytst is given, the predictive mean (original scale) otherwise
+    torch::Tensor forward( const torch::Tensor& Xtrn,
+                           const torch::Tensor& ytrn,
+                           const torch::Tensor& Xtst,
+                           const c10::optional<torch::Tensor>& ytst,
+                           Arena* arena = nullptr )
+    { 
+      torch::Tensor h;
+      c10::optional<torch::Tensor> y = ytst;
+      prep::Stats s;
+      if (prep_)
+      {
+        s = prep::fit(Xtrn, ytrn);
+        h = _hidden(prep::x(Xtrn,s), prep::y(ytrn,s), prep::x(Xtst,s), arena);
+        if (ytst.has_value())
+          y = prep::target(ytst.value(), s);
+      }
       else
-        return loss->mean(decoder(encoder(src, mask)).
-          index({Slice(Xtrn.size(0), None), Slice(), Slice()}));
+        h = _hidden(Xtrn, ytrn, Xtst, arena);
+
+      if (y.has_value())
+        return hier_ ? hloss(h, y.value()) : loss(decoder(h), y.value());
+
+      auto mean = hier_ ? hloss->mean(h) : loss->mean(decoder(h));
+      return prep_ ? prep::unscale(mean, s) : mean;
     }
 
   };
@@ -0,0 +1,367 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: libpfn, see pfn.h for the interface.
+  *
+*/
+#ifndef PRINT_
+#define PRINT(x) std::cout << #x << " =\n" << x << std::endl;
+#endif
+
+#include <torch/torch.h>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "riemann.h"
+#include "preprocess.h"
+#include "prior.h"
+#include "model.h"
+#include "context.h"
+#include "metrics.h"
+#include "io.h"
+#include "serve.h"
+#include "pfn.h"
+
+struct pfn_model
+{
+  pfn_config cfg;
+  model::SimplePFN net{nullptr};
+  std::unique_ptr<model::Context> ctx;
+  int64_t nfeat = 0;
+  std::shared_mutex mutex;
+
+  // Scratch of the predictions, one arena per prediction in flight. They
+  // run under the shared lock, so an arena is taken from the pool for the
+  // call and given back after it.
+  std::mutex pool_mutex;
+  std::vector<std::unique_ptr<Arena>> pool;
+};
+
+struct pfn_registry
+{
+  explicit pfn_registry( int64_t capacity ) : models(capacity) { }
+  serve::Registry models;
+};
+
+namespace
+{
+  thread_local std::string last_error;
+
+  // Run fn and turn whatever it throws into -1 + pfn_last_error()
+  template<class FN>
+  int _guard( FN&& fn )
+  {
+    try
+    {
+      fn();
+      return 0;
+    }
+    catch (const std::exception& e)
+    {
+      last_error = e.what();
+      return -1;
+    }
+  }
+
+  // Zero-copy view of caller memory as [n, 1, nfeat]
+  torch::Tensor _wrap( const float* X, int64_t n, int64_t nfeat )
+  {
+    return torch::from_blob(const_cast<float*>(X), {n, 1, nfeat},
+                            torch::kFloat).to(DEVICE);
+  }
+
+  // Same, off the CPU the copy goes to the buffer name of arena
+  torch::Tensor _wrap( const char* name, const float* X,
+                       at::IntArrayRef sizes, Arena& arena )
+  {
+    auto x = torch::from_blob(const_cast<float*>(X), sizes, torch::kFloat);
+    if (DEVICE.is_cpu())
+      return x;
+    return arena.Get(name, sizes, x.options().device(DEVICE)).copy_(x);
+  }
+
+  // An arena of the pool of pfn for the lifetime of the lease
+  class _Lease
+  {
+  public:
+    explicit _Lease( pfn_model* pfn ) : pfn_(pfn)
+    {
+      std::lock_guard<std::mutex> lock(pfn_->pool_mutex);
+      if (pfn_->pool.empty())
+        arena_ = std::make_unique<Arena>();
+      else
+      {
+        arena_ = std::move(pfn_->pool.back());
+        pfn_->pool.pop_back();
+      }
+    }
+
+    ~_Lease( )
+    {
+      std::lock_guard<std::mutex> lock(pfn_->pool_mutex);
+      pfn_->pool.push_back(std::move(arena_));
+    }
+
+    Arena& operator*( ) { return *arena_; }
+    Arena* operator->( ) { return arena_.get(); }
+    Arena* get( ) { return arena_.get(); }
+
+  private:
+    pfn_model* pfn_;
+    std::unique_ptr<Arena> arena_;
+  };
+
+  // Serving metrics, dumped once pfn_metrics is called
+  struct Meters
+  {
+    metrics::Counter requests, rows, errors;
+    metrics::Histogram latency;
+  };
+
+  const Meters& _meters( )
+  {
+    static const Meters m = []
+    {
+      auto& reg = metrics::Registry::GetInstance();
+      return Meters{
+        reg.MakeCounter("pfn_requests_total", "Prediction calls"),
+        reg.MakeCounter("pfn_rows_total", "Predicted rows"),
+        reg.MakeCounter("pfn_errors_total", "Failed prediction calls"),
+        reg.MakeHistogram("pfn_request_seconds", "Prediction latency") };
+    }();
+    return m;
+  }
+
+  // _guard of a prediction of m rows, counted and timed
+  template<class FN>
+  int _measure( int64_t m, FN&& fn )
+  {
+    const auto& meters = _meters();
+    int res;
+    {
+      metrics::Timer timer(meters.latency);
+      res = _guard(std::forward<FN>(fn));
+    }
+    meters.requests.Add();
+    if (res == 0)
+      meters.rows.Add(m);
+    else
+      meters.errors.Add();
+    return res;
+  }
+
+  // The model of cfg, the borders are overwritten by the checkpoint
+  model::SimplePFN _make( const pfn_config& cfg )
+  {
+    return model::SimplePFN(torch::linspace(0, 1, cfg.nbin + 1),
+                            cfg.dmodel, cfg.nhead, cfg.nencoder,
+                            cfg.nhid, cfg.infeat, cfg.hier != 0,
+                            cfg.prep != 0, cfg.nshare);
+  }
+
+  // Registry key of a checkpoint, the same file can be loaded with
+  // different (compatible) configurations
+  std::string _key( const char* path, const pfn_config& cfg )
+  {
+    std::ostringstream oss;
+    oss << path << "|" << cfg.dmodel << "," << cfg.nhead << ","
+        << cfg.nencoder << "," << cfg.nhid << "," << cfg.infeat << ","
+        << cfg.nbin << "," << cfg.hier << "," << cfg.prep << ","
+        << cfg.nshare;
+    return oss.str();
+  }
+
+  // Copy res into caller memory, converting the device/dtype on the way
+  void _unwrap( const torch::Tensor& res, float* out )
+  {
+    torch::from_blob(out, res.sizes(), torch::kFloat).copy_(res);
+  }
+}
+
+extern "C"
+{
+
+pfn_config pfn_default_config( void )
+{
+  pfn_config cfg;
+  cfg.dmodel = 256;
+  cfg.nhead = 4;
+  cfg.nencoder = 4;
+  cfg.nhid = 512;
+  cfg.infeat = 1;
+  cfg.nbin = 100;
+  cfg.hier = 0;
+  cfg.ctx = 0;
+  cfg.reservoir = 0;
+  cfg.prep = 0;
+  cfg.nshare = 1;
+  return cfg;
+}
+
+int pfn_init( int intra, int inter )
+{
+  return _guard([&]
+  {
+    if (inter > 0)
+      at::set_num_interop_threads(inter);
+    if (intra > 0)
+      at::set_num_threads(intra);
+  });
+}
+
+pfn_model* pfn_load( const char* path, const pfn_config* cfg )
+{
+  auto res = std::make_unique<pfn_model>();
+  int status = _guard([&]
+  {
+    TORCH_CHECK( cfg != nullptr, "No config given." );
+    res->cfg = *cfg;
+    res->net = _make(*cfg);
+
+    torch::serialize::InputArchive archive;
+    archive.load_from(path);
+    res->net->load(archive);
+    res->net->to(DEVICE);
+    res->net->eval();
+  });
+  return status == 0 ? res.release() : nullptr;
+}
+
+pfn_registry* pfn_registry_new( int64_t capacity )
+{
+  std::unique_ptr<pfn_registry> res;
+  int status = _guard([&]{ res = std::make_unique<pfn_registry>(capacity); });
+  return status == 0 ? res.release() : nullptr;
+}
+
+pfn_model* pfn_registry_get( pfn_registry* reg, const char* path,
+                             const pfn_config* cfg )
+{
+  auto res = std::make_unique<pfn_model>();
+  int status = _guard([&]
+  {
+    TORCH_CHECK( reg != nullptr && path != nullptr && cfg != nullptr,
+                 "No registry, path or config given." );
+    res->cfg = *cfg;
+    res->net = reg->models.Get(_key(path, *cfg), path,
+                               [cfg]{ return _make(*cfg); });
+  });
+  return status == 0 ? res.release() : nullptr;
+}
+
+int pfn_registry_stats( pfn_registry* reg, pfn_registry_stats* out )
+{
+  return _guard([&]
+  {
+    TORCH_CHECK( reg != nullptr && out != nullptr, "No registry given." );
+    auto s = reg->models.GetStats();
+    out->hits = s.hits;
+    out->misses = s.misses;
+    out->evictions = s.evictions;
+    out->resident = s.resident;
+    out->bytes = s.bytes;
+    out->hit_rate = s.HitRate();
+    out->load_seconds = s.load;
+    out->last_load_seconds = s.last;
+    out->max_load_seconds = s.max;
+  });
+}
+
+void pfn_registry_free( pfn_registry* reg )
+{
+  delete reg;
+}
+
+int pfn_set_context( pfn_model* pfn, const float* X, const float* y,
+                     int64_t n, int64_t nfeat )
+{
+  return _guard([&]
+  {
+    TORCH_CHECK( pfn != nullptr, "No model given." );
+    std::unique_lock<std::shared_mutex> lock(pfn->mutex);
+    c10::InferenceMode guard;
+
+    auto cap = pfn->cfg.ctx > 0 ? pfn->cfg.ctx : n;
+    pfn->ctx = std::make_unique<model::Context>(pfn->net, cap,
+      pfn->cfg.reservoir ? model::Evict::Reservoir : model::Evict::Window);
+    pfn->nfeat = nfeat;
+    pfn->ctx->Append(_wrap(X, n, nfeat), _wrap(y, n, 1));
+  });
+}
+
+int pfn_append_context( pfn_model* pfn, const float* X, const float* y,
+                        int64_t n, int64_t nfeat )
+{
+  return _guard([&]
+  {
+    TORCH_CHECK( pfn != nullptr, "No model given." );
+    std::unique_lock<std::shared_mutex> lock(pfn->mutex);
+    TORCH_CHECK( pfn->ctx, "Set a context first." );
+    TORCH_CHECK( nfeat == pfn->nfeat, "Number of features changed." );
+    c10::InferenceMode guard;
+
+    pfn->ctx->Append(_wrap(X, n, nfeat), _wrap(y, n, 1));
+  });
+}
+
+int pfn_predict_mean( pfn_model* pfn, const float* X, int64_t m,
+                      float* out )
+{
+  return _measure(m, [&]
+  {
+    TORCH_CHECK( pfn != nullptr, "No model given." );
+    std::shared_lock<std::shared_mutex> lock(pfn->mutex);
+    TORCH_CHECK( pfn->ctx, "Set a context first." );
+    c10::InferenceMode guard;
+
+    _Lease arena(pfn);
+    auto x = _wrap("pfn.x", X, {m, 1, pfn->nfeat}, *arena);
+    _unwrap(pfn->ctx->Predict(x, arena.get()), out);
+  });
+}
+
+int pfn_predict_quantiles( pfn_model* pfn, const float* X, int64_t m,
+                           const float* levels, int64_t nq, float* out )
+{
+  return _measure(m, [&]
+  {
+    TORCH_CHECK( pfn != nullptr, "No model given." );
+    std::shared_lock<std::shared_mutex> lock(pfn->mutex);
+    TORCH_CHECK( pfn->ctx, "Set a context first." );
+    c10::InferenceMode guard;
+
+    _Lease arena(pfn);
+    auto x = _wrap("pfn.x", X, {m, 1, pfn->nfeat}, *arena);
+    auto p = _wrap("pfn.p", levels, {nq}, *arena);
+
+    _unwrap(pfn->ctx->Quantiles(x, p, arena.get()), out);
+  });
+}
+
+int pfn_metrics( const char* prefix, double period )
+{
+  return _guard([&]
+  {
+    TORCH_CHECK( prefix != nullptr && period > 0., "Give a prefix and a "
+                 "period > 0." );
+    _meters();
+    metrics::Registry::GetInstance().Start(prefix, period);
+  });
+}
+
+void pfn_free( pfn_model* pfn )
+{
+  delete pfn;
+}
+
+const char* pfn_last_error( void )
+{
+  return last_error.c_str();
+}
+
+}
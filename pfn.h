@@ -0,0 +1,116 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: C interface of libpfn, in-process PFN inference.
+  *
+  * Usage:
+  *   pfn_init(4, 1);
+  *   pfn_config cfg = pfn_default_config();
+  *   pfn_model* m = pfn_load("epoch_100.pt", &cfg);
+  *   pfn_set_context(m, X, y, n, nfeat);
+  *   pfn_predict_mean(m, Xq, nq, out);
+  *   pfn_free(m);
+  *
+  * With many checkpoints in one process, get the models from a registry
+  * instead of pfn_load. Handles of the same checkpoint share the weights,
+  * the ones that were not used for a while are dropped when the weights of
+  * all of them would be over the capacity:
+  *   pfn_registry* reg = pfn_registry_new(512 << 20);
+  *   pfn_model* m = pfn_registry_get(reg, "epoch_100.pt", &cfg);
+  *   ...
+  *   pfn_free(m);
+  *   pfn_registry_free(reg);
+  *
+  * Arrays are row major float32, X is [n, nfeat], y is [n]. The functions
+  * returning int return 0 on success and -1 on failure, the ones returning
+  * a pointer NULL on failure; pfn_last_error() tells you why (per thread).
+  * Predictions can run concurrently from many threads on the same model,
+  * context updates wait for the running predictions.
+*/
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pfn_model pfn_model;
+typedef struct pfn_registry pfn_registry;
+
+// Has to match the model that was saved in the checkpoint
+typedef struct pfn_config
+{
+  int dmodel;
+  int nhead;
+  int nencoder;
+  int nhid;
+  int infeat;     // widest table, narrower ones are padded
+  int nbin;
+  int hier;       // two-level Riemann head
+  int64_t ctx;    // context capacity (0: size of the first context)
+  int reservoir;  // eviction of streamed rows, 0: sliding window 1: reservoir
+  int prep;       // per-dataset standardization, clipping and imputation
+  int nshare;     // consecutive layers sharing weights (1: untied)
+} pfn_config;
+
+pfn_config pfn_default_config( void );
+
+// Size of the intra-op and inter-op thread pools shared by all models.
+// Call it before anything else, inter-op can only be set once (0: default).
+int pfn_init( int intra, int inter );
+
+pfn_model* pfn_load( const char* path, const pfn_config* cfg );
+
+typedef struct pfn_registry_stats
+{
+  int64_t hits;
+  int64_t misses;             // loads
+  int64_t evictions;
+  int64_t resident;           // models
+  int64_t bytes;              // of the resident weights
+  double hit_rate;
+  double load_seconds;        // all the loads
+  double last_load_seconds;
+  double max_load_seconds;
+} pfn_registry_stats;
+
+// capacity: bytes of weights kept resident (the newest model always is)
+pfn_registry* pfn_registry_new( int64_t capacity );
+
+// A new handle (pfn_free it) on the resident model of the checkpoint,
+// loaded from the checkpoint file if it is not resident
+pfn_model* pfn_registry_get( pfn_registry* reg, const char* path,
+                             const pfn_config* cfg );
+
+int pfn_registry_stats( pfn_registry* reg, pfn_registry_stats* out );
+
+// The handles stay valid, they keep their weights
+void pfn_registry_free( pfn_registry* reg );
+
+// Replace the context with n labelled rows
+int pfn_set_context( pfn_model* model, const float* X, const float* y,
+                     int64_t n, int64_t nfeat );
+
+// Stream n more labelled rows into the context
+int pfn_append_context( pfn_model* model, const float* X, const float* y,
+                        int64_t n, int64_t nfeat );
+
+// out: [m]
+int pfn_predict_mean( pfn_model* model, const float* X, int64_t m,
+                      float* out );
+
+// levels: [nq] in (0,1), out: [m, nq]
+int pfn_predict_quantiles( pfn_model* model, const float* X, int64_t m,
+                           const float* levels, int64_t nq, float* out );
+
+// Dump the request counts and latencies every period seconds to
+// <prefix>.prom (Prometheus text) and <prefix>.jsonl, for all models
+int pfn_metrics( const char* prefix, double period );
+
+void pfn_free( pfn_model* model );
+
+const char* pfn_last_error( void );
+
+#ifdef __cplusplus
+}
+#endif
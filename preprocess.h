@@ -0,0 +1,92 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Per-dataset preprocessing of the inputs. Statistics come from
+  * the train part of each dataset (dim 1 is the dataset, dim 0 the rows) and
+  * are applied to train and test alike:
+  *  - features and targets are standardized,
+  *  - outliers are clipped at clip standard deviations,
+  *  - missing values (NaN) are imputed with the mean (0 after scaling).
+  * The target transform is affine, so the Riemann outputs can be mapped
+  * back (unscale/invert).
+*/
+#pragma once
+
+namespace prep
+{
+  using Tensor = torch::Tensor;
+
+  struct Stats
+  {
+    Tensor xmean, xstd;  // [1, B, nfeat]
+    Tensor ymean, ystd;  // [1, B, 1]
+    double clip = 4.;
+  };
+
+  // Statistics of all features and the target in one pass over the train set
+  // (biased std). A column with less than two observed rows has no spread
+  // to speak of, it is only centered (std 1).
+  Stats fit( const Tensor& Xtrn, const Tensor& ytrn, double clip = 4. )
+  {
+    auto xy = torch::cat({Xtrn, ytrn}, 2);
+    auto ok = ~xy.isnan();
+    auto n = ok.sum(0, true).clamp_min(1).to(xy.scalar_type());
+    auto v = xy.nan_to_num(0.);
+    auto mean = v.sum(0, true) / n;
+    auto std = ((v - mean) * ok).square().sum(0, true).div(n)
+                 .sqrt().clamp_min(1e-6);
+    std.masked_fill_(n < 2, 1.);
+
+    const auto nfeat = Xtrn.size(2);
+    return { mean.narrow(2, 0, nfeat), std.narrow(2, 0, nfeat),
+             mean.narrow(2, nfeat, 1), std.narrow(2, nfeat, 1), clip };
+  }
+
+  // Features (train or test) [n, B, nfeat]
+  Tensor x( const Tensor& X, const Stats& s )
+  {
+    return ((X - s.xmean) / s.xstd).clamp(-s.clip, s.clip).nan_to_num(0.);
+  }
+
+  // Targets given to the model [n, B, 1]
+  Tensor y( const Tensor& y, const Stats& s )
+  {
+    return ((y - s.ymean) / s.ystd).clamp(-s.clip, s.clip).nan_to_num(0.);
+  }
+
+  // Targets of the loss, no clipping and NaN stays NaN (Riemann ignores it)
+  Tensor target( const Tensor& y, const Stats& s )
+  {
+    return (y - s.ymean) / s.ystd;
+  }
+
+  // Values in the target space (means, quantiles, ...) [m, B, ...] back to
+  // the original scale
+  Tensor unscale( const Tensor& t, const Stats& s )
+  {
+    auto shape = std::vector<int64_t>(t.dim(), 1);
+    shape[1] = s.ymean.size(1);
+    return t * s.ystd.view(shape) + s.ymean.view(shape);
+  }
+
+  // The predictive distribution in the original scale. The cdf/nll are only
+  // right if they were evaluated at target(y).
+  dist::Predictive invert( dist::Predictive res, const Stats& s )
+  {
+    auto scale = [&]( const Tensor& t )
+    {
+      auto shape = std::vector<int64_t>(t.dim(), 1);
+      shape[1] = s.ystd.size(1);
+      return s.ystd.view(shape);
+    };
+
+    for (auto* t : {&res.mean, &res.quantiles, &res.lower, &res.upper})
+      if (t->defined())
+        *t = unscale(*t, s);
+    if (res.var.defined())
+      res.var = res.var * scale(res.var).square();
+    if (res.nll.defined())
+      res.nll = res.nll + scale(res.nll).log();
+    return res;
+  }
+}
@@ -5,7 +5,9 @@
   *
 */
 #pragma once
+#include <algorithm>
 #include <tuple>
+#include <vector>
 
 namespace prior
 {
@@ -20,6 +22,14 @@ namespace prior
     virtual std::tuple<Tensor, Tensor>
     Sample(int nset, int nsamp, int nfeat) const = 0;
 
+    // Same, but the result may live in the buffers of the arena (so it is 
+    // overwritten by the next call with that arena).
+    virtual std::tuple<Tensor, Tensor>
+    Sample(int nset, int nsamp, int nfeat, Arena& arena) const
+    {
+      return Sample(nset, nsamp, nfeat);
+    }
+
     Tensor _Bins( int num_outputs,
                   const c10::optional<torch::Tensor>& full_range,
                   const c10::optional<torch::Tensor>& ys )
@@ -68,10 +78,27 @@ namespace prior
       return borders;
     }
 
-    Tensor Border( int nsamp, int nfeat, int nbin )
+    // With standardize the targets of each dataset are standardized first
+    // (with prep::fit, the same estimator as the model), for models that see
+    // preprocessed targets.
+    // The datasets are sampled in chunks of one arena, only their targets
+    // are kept, so the intermediates of a prior (the features of a GP, ...)
+    // never exist for all of them at once.
+    Tensor Border( int nsamp, int nfeat, int nbin, bool standardize = false,
+                   int nset = 100000, int chunk = 1000 )
     {
-      auto res = this->Sample(100000, nsamp, nfeat);
-      return this-> _Bins(nbin, c10::nullopt, std::get<1>(res));
+      Arena arena;
+      std::vector<Tensor> chunks;
+      for (int done = 0; done < nset; done += chunk)
+      {
+        auto res = this->Sample(std::min(chunk, nset - done), nsamp, nfeat,
+                                arena);
+        auto ys = std::get<1>(res);
+        if (standardize)
+          ys = prep::target(ys, prep::fit(std::get<0>(res), ys));
+        chunks.push_back(ys.clone());
+      }
+      return this-> _Bins(nbin, c10::nullopt, torch::cat(chunks, 1));
     }
   };
 
@@ -87,92 +114,37 @@ namespace prior
   public:
     explicit LinearTasks(O a=0, O b=1, O c=1) : a_(a) , b_(b) , c_(c) { }
 
+    // Fresh buffers, same draws as with an arena
     std::tuple<Tensor, Tensor>
     Sample(int nset, int nsamp, int nfeat) const override
     {
-      Tensor x,w,xs,ys,e;
-
-      w  = torch::normal(0, c_, {nset, nfeat + 1});
-      xs = torch::normal(0, b_, {nset, nsamp, nfeat});
-
-      x = torch::cat( { xs, torch::ones({nset, nsamp, 1},
-                        xs.options()) }, -1);
-
-      ys = torch::bmm(x, w.unsqueeze(2)).squeeze(-1);
-      e  = torch::normal(0, a_, ys.sizes());
-
-      return std::make_tuple( xs.transpose(0, 1),
-                              (ys + e).transpose(0, 1).unsqueeze(-1));
+      Arena arena;
+      return Sample(nset, nsamp, nfeat, arena);
     }
 
-
-
-  private:
-    O a_, b_, c_;
-  };
-  // Sample datasets from 
-  // y = x^t @ w + e
-  // w -> 
-  // e ~ N(0,a) -> noise
-  // x ~ N(0,b) -> input (we must augment this with ones to match the bias)
-  // w ~ N(0,c) -> task (includes the offset (bias) as well)
-  // libtorch does not have multivariate option so anything you see is isotropic
-  /* template<class O=double> */
-  /* std::tuple<Tensor, Tensor> linear( int nset, int nsamp, int nfeat, */
-  /*                                    O a = 0.0, O b = 1., O c = 1.) */
-  /* { */
-  /*   Tensor x, w, xs, ys, e; */
-  /*   w =  torch::normal(0, c, {nset,nfeat+1}); */
-  /*   xs = torch::normal(0, b, {nset,nsamp,nfeat}); */
-  /*   x = torch::cat({xs,torch::ones({nset,nsamp,1})}, -1); */ 
-  /*   ys = torch::bmm(x,w.unsqueeze(2)).squeeze(-1); */
-  /*   e  = torch::normal(0, a, ys.sizes()); */
-  /*   return std::make_tuple( xs.transpose(0,1), */
-  /*                           (ys+e).transpose(0,1).unsqueeze(-1) ); */
-  /* } */
-
-  template<class O = double>
-  class LinearSampler
-  {
-  public:
-    explicit LinearSampler(O a_, O b_, O c_)
-      : a(a_)
-      , b(b_)
-      , c(c_)
+    std::tuple<Tensor, Tensor>
+    Sample(int nset, int nsamp, int nfeat, Arena& arena) const override
     {
-    }
+      auto x  = arena.Get("prior.x", {nset, nsamp, nfeat + 1});
+      auto w  = arena.Get("prior.w", {nset, nfeat + 1, 1});
+      auto ys = arena.Get("prior.y", {nset, nsamp, 1});
+      auto e  = arena.Get("prior.e", {nset, nsamp, 1});
 
-    std::tuple<Tensor, Tensor> sample(int nset, int nsamp, int nfeat) const
-    {
-      Tensor x;
-      Tensor w;
-      Tensor xs;
-      Tensor ys;
-      Tensor e;
+      w.normal_(0, c_);
+      auto xs = x.narrow(2, 0, nfeat).normal_(0, b_);
+      x.narrow(2, nfeat, 1).fill_(1.);
 
-      w  = torch::normal(0, c, {nset, nfeat + 1});
-      xs = torch::normal(0, b, {nset, nsamp, nfeat});
+      torch::bmm_out(ys, x, w);
+      ys.add_(e.normal_(0, a_));
 
-      x = torch::cat(
-        {
-          xs,
-          torch::ones({nset, nsamp, 1}, xs.options())
-        },
-        -1
-      );
-
-      ys = torch::bmm(x, w.unsqueeze(2)).squeeze(-1);
-      e  = torch::normal(0, a, ys.sizes());
-
-      return std::make_tuple(
-        xs.transpose(0, 1),
-        (ys + e).transpose(0, 1).unsqueeze(-1)
-      );
+      return std::make_tuple( xs.transpose(0, 1), ys.transpose(0, 1) );
     }
 
+    O Noise( ) const { return a_; }   // std of e
+    O Input( ) const { return b_; }   // std of x
+    O Weight( ) const { return c_; }  // std of w
+
   private:
-    O a;
-    O b;
-    O c;
+    O a_, b_, c_;
   };
 }
@@ -0,0 +1,118 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Local-context inference for train tables that are larger than
+  * what the model can attend to. Test rows are grouped in chunks, every chunk
+  * gets the k nearest train rows as its own context and the chunks are pushed
+  * through the model as one batch.
+  *
+*/
+#pragma once
+
+namespace model
+{
+  struct RetrievalOptions
+  {
+    int64_t k = 512;       // context size per chunk
+    int64_t chunk = 16;    // test rows sharing one context
+    int64_t tile = 8192;   // train rows per distance tile
+    int64_t batch = 64;    // chunks per forward
+  };
+
+  // Brute force kNN over tiles of the train set. The distance of a train row
+  // to a chunk is its distance to the closest member of the chunk.
+  // Xtrn: [N, nfeat], Xq: [nchunk, chunk, nfeat] -> [nchunk, k] train indices
+  torch::Tensor knn_chunks( const torch::Tensor& Xtrn,
+                            const torch::Tensor& Xq,
+                            int64_t k, int64_t tile )
+  {
+    const auto N = Xtrn.size(0);
+    const auto nc = Xq.size(0);
+    k = std::min(k, N);
+
+    auto lopts = Xq.options().dtype(torch::kLong);
+    auto best_d = torch::full({nc, k}, std::numeric_limits<float>::infinity(),
+                              Xq.options());
+    auto best_i = torch::zeros({nc, k}, lopts);
+    auto qq = Xq.pow(2).sum(-1, true);
+
+    for (int64_t s = 0; s < N; s += tile)
+    {
+      auto T = Xtrn.narrow(0, s, std::min(tile, N - s));
+      // |q|^2 + |t|^2 - 2 q.t, the last term is a single GEMM per tile
+      auto d = torch::matmul(Xq, T.t()).mul_(-2.)
+                 .add_(qq).add_(T.pow(2).sum(-1).view({1, 1, -1}));
+      auto dmin = d.amin(1);
+
+      auto cand_d = torch::cat({best_d, dmin}, 1);
+      auto cand_i = torch::cat({best_i,
+        torch::arange(s, s + T.size(0), lopts).expand({nc, T.size(0)})}, 1);
+
+      auto top = torch::topk(cand_d, k, 1, false);
+      best_d = std::get<0>(top);
+      best_i = cand_i.gather(1, std::get<1>(top));
+    }
+    return best_i;
+  }
+
+  // Logits of the test rows with retrieved contexts.
+  // Xtrn: [N, 1, nfeat], ytrn: [N, 1, 1], Xtst: [M, 1, nfeat] -> [M, 1, nbin]
+  torch::Tensor local_logits( SimplePFN model,
+                              const torch::Tensor& Xtrn,
+                              const torch::Tensor& ytrn,
+                              const torch::Tensor& Xtst,
+                              const RetrievalOptions& opts = {} )
+  {
+    torch::NoGradGuard nograd;
+    TORCH_CHECK( Xtrn.size(1) == 1 && Xtst.size(1) == 1,
+                 "Local context works on a single dataset." );
+    TORCH_CHECK( !model->prep_,
+                 "Local contexts would each get their own target scale, use a"
+                 " model without preprocessing." );
+
+    const auto M = Xtst.size(0);
+    const auto f = Xtrn.size(2);
+    const auto c = opts.chunk;
+
+    auto X = Xtrn.squeeze(1).contiguous();
+    auto y = ytrn.squeeze(1).contiguous();
+
+    // neighbouring test rows should share a chunk, sort them along the
+    // first feature and pad the last chunk with copies of the last row
+    auto order = torch::argsort(Xtst.select(2, 0).squeeze(1));
+    const auto nc = (M + c - 1) / c;
+    auto rows = torch::cat({order, order.index({-1}).expand({nc * c - M})});
+    auto Xq = Xtst.squeeze(1).index_select(0, rows).view({nc, c, f});
+
+    std::vector<torch::Tensor> out;
+    for (int64_t s = 0; s < nc; s += opts.batch)
+    {
+      const auto g = std::min(opts.batch, nc - s);
+      auto q = Xq.narrow(0, s, g);
+      auto idx = knn_chunks(X, q, opts.k, opts.tile);
+      const auto k = idx.size(1);
+
+      auto Xc = X.index_select(0, idx.flatten()).view({g, k, f});
+      auto yc = y.index_select(0, idx.flatten()).view({g, k, 1});
+
+      // [chunk, g, nbin] -> [g*chunk, nbin]
+      auto lg = model->logits(Xc.transpose(0, 1),
+                              yc.transpose(0, 1),
+                              q.transpose(0, 1));
+      out.push_back(lg.transpose(0, 1).reshape({g * c, -1}));
+    }
+
+    auto res = torch::empty({M, out[0].size(-1)}, out[0].options());
+    res.index_copy_(0, order, torch::cat(out).narrow(0, 0, M));
+    return res.unsqueeze(1);
+  }
+
+  torch::Tensor local_predict( SimplePFN model,
+                               const torch::Tensor& Xtrn,
+                               const torch::Tensor& ytrn,
+                               const torch::Tensor& Xtst,
+                               const RetrievalOptions& opts = {} )
+  {
+    return model->loss->mean(local_logits(model, Xtrn, ytrn, Xtst, opts));
+  }
+}
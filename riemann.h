@@ -9,6 +9,18 @@ namespace dist
 {
   using namespace torch;
 
+  // Output of RiemannImpl::predict_distribution, only the requested ones are 
+  // defined. Leading dimensions follow the logits.
+  struct Predictive
+  {
+    Tensor probs;      // [..., nbin]
+    Tensor mean, var;  // [...]
+    Tensor quantiles;  // [..., Q]
+    Tensor lower;      // [...] lower end of the prediction interval
+    Tensor upper;      // [...] upper end of the prediction interval
+    Tensor cdf, nll;   // [..., M]
+  };
+
   struct RiemannImpl : nn::Module
   {
     RiemannImpl ( const Tensor& bins, bool ignore = true ) : 
@@ -16,8 +28,6 @@ namespace dist
     {
       TORCH_CHECK( bins.dim() == 1, "Expecting a 1D Tensor..." );
       bins_ = register_buffer("bins_", std::get<0>(sort(bins)).contiguous());
-      auto widths = _bucket_widths( );
-      Tensor width = widths.sum();
     };
 
     // Get all bucket widths
@@ -30,12 +40,9 @@ namespace dist
     // Find which bin the outputs fall
     Tensor _map( const Tensor& y ) const
     {
-      auto res = searchsorted(bins_,y)-1;
-      // these are for the boundery values and the more extremee values observed
-      res.index_put_({y == bins_.index({0})}, 0);
-      res.index_put_({y == bins_.index({-1})}, _nbins() - 1);
-      res = torch::clamp(res, 0, _nbins() - 1);  // clamp to valid bin range
-      return res;
+      // the boundary values and the more extreme values observed end up in
+      // the first/last bucket
+      return torch::clamp(searchsorted(bins_,y)-1, 0, _nbins() - 1);
     }
 
     // Where to ignore? Let op; your labels are now adjusted;
@@ -49,26 +56,33 @@ namespace dist
       return where;
     }
 
-    // Get the number of bins
+    // Get the number of bins (buckets between the borders)
     int _nbins( ) const 
     {
-      return bins_.numel() - 2;
+      return bins_.numel() - 1;
     };
 
+    // Nothing is kept in the module, a model may run forwards on many
+    // threads at once
     Tensor forward(const Tensor& logits, const Tensor& y)
     {
-      auto y_ = y.clone().contiguous();
-
-      Tensor ignore_mask = _ignore(y_);
+      // Put all the nan's to the borders... (on the device, no sync for the
+      // value of the first border)
+      Tensor y_;
+      if (ignore_)
+        y_ = torch::where(y.isnan(), bins_.narrow(0, 0, 1).to(y.dtype()), y);
+      else
+      {
+        y_ = y.clone();
+        _ignore(y_);
+      }
+
+      // same as _map: the border values end up in the first/last bucket
+      auto target = searchsorted(bins_, y_).sub_(1).clamp_(0, _nbins() - 1);
 
       auto logits_ = logits.view({-1, logits.size(2)});
 
-      Tensor target = _map(y_).view(-1);
-
-      nn::CrossEntropyLoss crs;
-
-      auto res = crs(logits_, target);
-      return res;
+      return nn::functional::cross_entropy(logits_, target.view(-1));
     }
 
     torch::Tensor mean(const torch::Tensor& logits)
@@ -77,12 +91,264 @@ namespace dist
       return torch::matmul(torch::softmax(logits, -1), bucket_means);
     }
 
+    // Piecewise linear CDF of the bucket probabilities evaluated at t.
+    // probs: [..., nbin], t: [..., M] (leading dims broadcast to the probs)
+    // below: mass under each bucket (exclusive cumsum), if you already have it
+    Tensor _cdf( const Tensor& probs, const Tensor& t,
+                 const c10::optional<Tensor>& below = c10::nullopt ) const
+    {
+      auto shape = probs.sizes().vec();
+      shape.back() = t.size(-1);
+
+      auto t_ = t.expand(shape).clamp(bins_.index({0}), bins_.index({-1}));
+      auto idx = torch::clamp(searchsorted(bins_, t_, false, true) - 1,
+                              0, probs.size(-1) - 1);
+
+      auto lo = bins_.index_select(0, idx.flatten()).view_as(idx);
+      auto width = _bucket_widths().index_select(0, idx.flatten()).view_as(idx);
+
+      auto cum = below.has_value() ? below.value() : 
+                                     torch::cumsum(probs, -1) - probs;
+      return cum.gather(-1, idx) + probs.gather(-1, idx) * (t_ - lo) / width;
+    }
+
+    // Everything we can say about the predictive distribution from a single
+    // softmax and a single cumsum over the buckets.
+    //  q     : quantile levels [Q] 
+    //  y     : values [..., M] to get the CDF and the NLL at
+    //  level : coverage of the central prediction interval (<= 0 to skip)
+    Predictive predict_distribution( const Tensor& logits,
+                                 const c10::optional<Tensor>& q = c10::nullopt,
+                                 const c10::optional<Tensor>& y = c10::nullopt,
+                                 double level = 0.9 ) const
+    {
+      using namespace indexing;
+      Predictive res;
+
+      auto logp = torch::log_softmax(logits, -1);
+      res.probs = logp.exp();
+
+      auto widths = _bucket_widths();
+      auto mids = bins_.slice(0, 0, -1) + widths / 2.0;
+
+      // uniform within a bucket -> second moment is mid^2 + width^2/12
+      auto moments = torch::stack({mids, mids*mids + widths*widths/12.}, 1);
+      auto m = torch::matmul(res.probs, moments);
+      res.mean = m.select(-1, 0);
+      res.var = (m.select(-1, 1) - res.mean*res.mean).clamp_min(0.);
+
+      auto cum = torch::cumsum(res.probs, -1);
+      auto below = cum - res.probs;
+
+      // All the requested levels (and the interval ends) in one go
+      std::vector<Tensor> levels;
+      if (q.has_value())
+        levels.push_back(q.value().to(logits.options()).flatten());
+      if (level > 0.)
+        levels.push_back(torch::tensor({(1.-level)/2., (1.+level)/2.},
+                                        logits.options()));
+      if (!levels.empty())
+      {
+        auto p = torch::cat(levels);
+        auto shape = res.probs.sizes().vec();
+        shape.back() = p.numel();
+        p = p.expand(shape).contiguous();
+
+        auto idx = torch::clamp(searchsorted(cum, p), 0, res.probs.size(-1)-1);
+        auto lo = bins_.index_select(0, idx.flatten()).view_as(idx);
+        auto width = widths.index_select(0, idx.flatten()).view_as(idx);
+        auto frac = ((p - below.gather(-1, idx)) /
+                      res.probs.gather(-1, idx).clamp_min(1e-12)).clamp(0., 1.);
+        auto quant = lo + frac * width;
+
+        int64_t nq = q.has_value() ? q.value().numel() : 0;
+        if (q.has_value())
+          res.quantiles = quant.index({"...", Slice(0, nq)});
+        if (level > 0.)
+        {
+          res.lower = quant.index({"...", nq});
+          res.upper = quant.index({"...", nq + 1});
+        }
+      }
+
+      if (y.has_value())
+      {
+        res.cdf = _cdf(res.probs, y.value(), below);
+
+        // density inside the bucket is p/width
+        auto yv = y.value().expand(res.cdf.sizes()).contiguous();
+        auto idx = _map(yv);
+        auto width = widths.index_select(0, idx.flatten()).view_as(idx);
+        res.nll = -logp.gather(-1, idx) + torch::log(width);
+      }
+
+      return res;
+    }
+
     bool ignore_;
     Tensor bins_;
 
   };
   TORCH_MODULE(Riemann);
 
+  // Two-level Riemann head: the nbin buckets are grouped in C coarse buckets
+  // of F fine buckets each (nbin = C*F, C ~ sqrt(nbin)). 
+  //    p(bucket) = p(coarse) * p(fine | coarse)
+  // Unlike the flat head this one works on the hidden states (it owns the
+  // projections) since only the fine projections that are needed are used.
+  // The loss costs O(d*(C+F)) per token instead of O(d*nbin).
+  struct HierRiemannImpl : nn::Module
+  {
+    HierRiemannImpl ( const Tensor& bins, int dmodel, bool ignore = true )
+    {
+      fine = register_module("fine", Riemann(bins, ignore));
+      nbin_ = bins.numel() - 1;
+
+      // the divisor of nbin closest to sqrt(nbin)
+      C_ = 1;
+      for (int c = 1; c * c <= nbin_; c++)
+        if (nbin_ % c == 0)
+          C_ = c;
+      F_ = nbin_ / C_;
+      TORCH_CHECK( C_ > 1, "The two-level head needs an nbin that is not "
+                   "prime (nbin = C*F with C > 1), got ", nbin_ );
+
+      coarse = register_module("coarse", nn::Linear(dmodel, C_));
+      weight = register_parameter("weight", 
+                                  torch::randn({C_, F_, dmodel}) / 
+                                                      std::sqrt(dmodel));
+      bias = register_parameter("bias", torch::zeros({C_, F_}));
+    }
+
+    // Fine log-probabilities of the coarse bucket c for each row
+    // h: [n, d], c: [n] -> [n, F]
+    // Rows are grouped per coarse bucket so we only do small GEMM's, the
+    // extra memory is a sorted copy of h and the [n, F] outputs. On a device
+    // the group sizes cost one copy of the C counts to the host per call;
+    // gathering the fine weights of every row instead avoids it but needs
+    // [n, F, d], F*d per row against the nbin logits of the flat head.
+    Tensor _fine( const Tensor& h, const Tensor& c ) const
+    {
+      auto sorted = torch::sort(c);
+      auto order = std::get<1>(sorted);
+      auto counts = torch::bincount(c, {}, C_).cpu();
+      auto cnt = counts.accessor<int64_t,1>();
+
+      std::vector<Tensor> segs;
+      int64_t start = 0;
+      for (int64_t k = 0; k < C_; k++)
+      {
+        if (cnt[k] == 0)
+          continue;
+        auto rows = order.narrow(0, start, cnt[k]);
+        segs.push_back(torch::log_softmax(
+            torch::nn::functional::linear(h.index_select(0, rows),
+                                          weight[k], bias[k]), -1));
+        start += cnt[k];
+      }
+      auto inv = torch::empty_like(order).scatter_(0, order,
+                              torch::arange(order.numel(), order.options()));
+      return torch::cat(segs).index_select(0, inv);
+    }
+
+    // Cross-entropy over all nbin buckets
+    Tensor forward( const Tensor& h, const Tensor& y )
+    {
+      auto y_ = y.clone().contiguous();
+      fine->_ignore(y_);
+
+      auto h_ = h.reshape({-1, h.size(-1)});
+      auto j = fine->_map(y_).view(-1);
+      auto c = j.div(F_, "floor");
+      auto f = j.remainder(F_);
+
+      auto lc = torch::log_softmax(coarse(h_), -1).gather(1, c.unsqueeze(1));
+      auto lf = _fine(h_, c).gather(1, f.unsqueeze(1));
+      return -(lc + lf).mean();
+    }
+
+    // Average density NLL: the bucket cross-entropy + log width of the
+    // bucket of each target (the same bucket the cross-entropy uses)
+    Tensor nll( const Tensor& h, const Tensor& y )
+    {
+      auto y_ = y.clone().contiguous();
+      fine->_ignore(y_);
+      auto j = fine->_map(y_).view(-1);
+      return forward(h, y) +
+             fine->_bucket_widths().index_select(0, j).log().mean();
+    }
+
+    // Mean with fine resolution in the top most likely coarse buckets, the
+    // rest only contribute with their centers.
+    Tensor mean( const Tensor& h, int top = 4 )
+    {
+      auto h_ = h.reshape({-1, h.size(-1)});
+      const auto n = h_.size(0);
+      top = std::min<int>(top, C_);
+
+      auto lo = fine->bins_.slice(0, 0, -1).view({C_, F_});
+      auto mids = lo + fine->_bucket_widths().view({C_, F_}) / 2.;
+      auto cmid = (fine->bins_.slice(0, 0, -1).view({C_, F_}).select(1, 0) +
+                   fine->bins_.slice(0, 1).view({C_, F_}).select(1, F_-1))/2.;
+
+      auto pc = torch::softmax(coarse(h_), -1);
+      auto res = torch::matmul(pc, cmid);
+
+      auto sel = torch::topk(pc, top, 1);
+      auto ctop = std::get<1>(sel).flatten();
+      auto rows = torch::arange(n, ctop.options()).repeat_interleave(top);
+      auto pf = _fine(h_.index_select(0, rows), ctop).exp();
+      auto ef = (pf * mids.index_select(0, ctop)).sum(-1).view({n, top});
+      res += (std::get<0>(sel) * (ef - cmid.index_select(0, ctop)
+                                                  .view({n, top}))).sum(-1);
+
+      auto shape = h.sizes().vec();
+      shape.pop_back();
+      return res.view(shape);
+    }
+
+    // Quantiles at the levels p [Q]: the coarse CDF picks the bucket, its fine 
+    // distribution is only evaluated for that bucket. -> [..., Q]
+    Tensor quantile( const Tensor& h, const Tensor& p )
+    {
+      auto h_ = h.reshape({-1, h.size(-1)});
+      const auto n = h_.size(0);
+      const auto Q = p.numel();
+
+      auto pc = torch::softmax(coarse(h_), -1);
+      auto cumc = torch::cumsum(pc, -1);
+      auto p_ = p.to(pc.options()).view({1, Q}).expand({n, Q}).contiguous();
+
+      auto c = torch::clamp(searchsorted(cumc, p_), 0, C_ - 1);
+      auto pcc = pc.gather(1, c);
+      auto within = ((p_ - (cumc.gather(1, c) - pcc)) / pcc.clamp_min(1e-12))
+                      .clamp(0., 1.).view({-1, 1});
+
+      auto rows = torch::arange(n, c.options()).repeat_interleave(Q);
+      auto pf = _fine(h_.index_select(0, rows), c.flatten()).exp();
+      auto cumf = torch::cumsum(pf, -1);
+      auto f = torch::clamp(searchsorted(cumf, within), 0, F_ - 1);
+      auto pff = pf.gather(1, f);
+      auto frac = ((within - (cumf.gather(1, f) - pff)) / pff.clamp_min(1e-12))
+                    .clamp(0., 1.);
+
+      auto j = (c.flatten() * F_ + f.flatten());
+      auto lo = fine->bins_.index_select(0, j);
+      auto width = fine->_bucket_widths().index_select(0, j);
+      auto res = lo + frac.flatten() * width;
+
+      auto shape = h.sizes().vec();
+      shape.back() = Q;
+      return res.view(shape);
+    }
+
+    int nbin_, C_, F_;
+    Riemann fine = nullptr;
+    nn::Linear coarse = nullptr;
+    Tensor weight, bias;
+  };
+  TORCH_MODULE(HierRiemann);
+
 template<class O=double>
 Tensor bin_borders( int num_outputs,
                     const c10::optional<torch::Tensor>& full_range,
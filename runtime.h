@@ -0,0 +1,224 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Where do we run? Thread pools, core pinning and NUMA
+  * placement. Linux only, elsewhere the pinning silently does nothing.
+  *
+  * Flags (see Configure):
+  *   --intra n       intra-op threads (0: libtorch default)
+  *   --inter n       inter-op threads (0: libtorch default)
+  *   --numa  k       run the compute on the cores of NUMA node k and prefer
+  *                   its memory (-1: off)
+  *   --cores 0-7     cores of the compute threads (overrides --numa cores)
+  *   --sampcores 8,9 cores of the prior sampling thread, if given the next
+  *                   batch is sampled there while the current one trains
+  *                   (not reproducible, both threads use the default
+  *                   generator)
+*/
+#pragma once
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <queue>
+#include <functional>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace runtime
+{
+  // "0-3,8,10-11" -> {0,1,2,3,8,10,11}
+  std::vector<int> parse_cores( const std::string& list )
+  {
+    std::vector<int> cores;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+      if (item.empty())
+        continue;
+      auto dash = item.find('-');
+      if (dash == std::string::npos)
+        cores.push_back(std::stoi(item));
+      else
+        for (int c = std::stoi(item.substr(0, dash));
+                 c <= std::stoi(item.substr(dash + 1)); c++)
+          cores.push_back(c);
+    }
+    return cores;
+  }
+
+  // Cores of a NUMA node, empty if there is no such node
+  std::vector<int> numa_cores( int node )
+  {
+    std::ifstream file("/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!file || !std::getline(file, list))
+      return {};
+    return parse_cores(list);
+  }
+
+  // Pin the calling thread, threads it creates afterwards inherit this
+  bool pin( const std::vector<int>& cores )
+  {
+#ifdef __linux__
+    if (cores.empty())
+      return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cores)
+      CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+  // Number of cores the calling thread may run on (its affinity set, so
+  // what is left after a pin, a cgroup or taskset)
+  int ncores( )
+  {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+      return CPU_COUNT(&set);
+#endif
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // Prefer the memory of the given node for the calling thread (and the ones
+  // it creates afterwards). No libnuma needed, this is set_mempolicy(2).
+  // The node mask is a single word, nodes past its width are rejected.
+  bool prefer_node( int node )
+  {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    const int MPOL_PREFERRED_ = 1;
+    if (node < 0 || node >= int(sizeof(unsigned long) * 8))
+      return false;
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED_, &mask,
+                   sizeof(mask) * 8) == 0;
+#else
+    return false;
+#endif
+  }
+
+  // Set up the main (compute) thread. Call it before the model is created
+  // and before any parallel work, so that the thread pools are spawned on
+  // the right cores and the first touch of the weights is on the right node.
+  void Configure( const CLIStore& conf )
+  {
+    auto inter = conf.Get<int>("inter");
+    auto intra = conf.Get<int>("intra");
+    auto node = conf.Get<int>("numa");
+    auto cores = parse_cores(conf.Get<std::string>("cores"));
+
+    if (node >= 0)
+    {
+      if (cores.empty())
+        cores = numa_cores(node);
+      if (!prefer_node(node))
+        PFN_LOG("Could not set the memory policy for NUMA node " << node);
+    }
+
+    if (!cores.empty() && !pin(cores))
+      PFN_LOG("Could not pin the compute threads.");
+
+    if (inter > 0)
+      at::set_num_interop_threads(inter);
+    if (intra > 0)
+      at::set_num_threads(intra);
+    else if (!cores.empty())
+      at::set_num_threads(cores.size());
+
+    PFN_LOG("Threads intra/inter-op: " << at::get_num_threads() << "/"
+                                       << at::get_num_interop_threads());
+  }
+
+  //---------------------------------------------------------------------------
+  // Worker : a single persistent thread that runs the jobs in order. Keeping
+  // the thread alive keeps its own intra-op team alive as well.
+  //---------------------------------------------------------------------------
+  class Worker
+  {
+  public:
+    explicit Worker( const std::vector<int>& cores = {} ) :
+      thread_([this, cores]
+      {
+        if (!cores.empty())
+          pin(cores);
+        _Loop();
+      })
+    { }
+
+    ~Worker( )
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      cv_.notify_all();
+      thread_.join();
+    }
+
+    template<class FN>
+    auto Submit( FN fn ) -> std::future<decltype(fn())>
+    {
+      using R = decltype(fn());
+      auto task = std::make_shared<std::packaged_task<R()>>(std::move(fn));
+      auto res = task->get_future();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push([task]{ (*task)(); });
+      }
+      cv_.notify_one();
+      return res;
+    }
+
+    // Jobs that are waiting or running
+    size_t Pending( )
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return jobs_.size() + busy_;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::queue<std::function<void()>> jobs_;
+    bool stop_ = false;
+    size_t busy_ = 0;
+    std::thread thread_; // last, it starts running right away
+
+    void _Loop( )
+    {
+      while (true)
+      {
+        std::function<void()> job;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          cv_.wait(lock, [this]{ return stop_ || !jobs_.empty(); });
+          if (jobs_.empty())
+            return;
+          job = std::move(jobs_.front());
+          jobs_.pop();
+          busy_++;
+        }
+        job();
+        std::lock_guard<std::mutex> lock(mutex_);
+        busy_--;
+      }
+    }
+  };
+}
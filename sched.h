@@ -0,0 +1,114 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Schedules over the training steps, the learning rate
+  * (linear warmup, then constant or cosine decay) and a curriculum that
+  * ramps the context length (nsamp) and the number of datasets (nset) from
+  * small to the full size. Everything is a function of the global step, so
+  * a resume with the saved settings continues exactly where it stopped.
+  *
+  * Flags:
+  *   --sched constant|cosine   --warmup steps   --minlr fraction of lr
+  *   --curriculum steps        --nsamp0 n       --nset0 n  (0: full size)
+*/
+#pragma once
+#include <cmath>
+
+namespace sched
+{
+  class Schedule
+  {
+  public:
+    Schedule( const CLIStore& conf, int total ) :
+      lr_(conf.Get<double>("lr")),
+      minlr_(conf.Get<double>("minlr")),
+      cosine_(conf.Get<std::string>("sched") == "cosine"),
+      warmup_(conf.Get<size_t>("warmup")),
+      total_(total),
+      ramp_(conf.Get<size_t>("curriculum")),
+      nsamp_(conf.Get<size_t>("nsamp")),
+      nset_(conf.Get<size_t>("nset")),
+      nsamp0_(std::min(conf.Get<size_t>("nsamp0"), nsamp_)),
+      nset0_(std::min(conf.Get<size_t>("nset0"), nset_))
+    {
+      TORCH_CHECK( conf.Get<std::string>("sched") == "constant" || cosine_,
+                   "Unknown schedule ", conf.Get<std::string>("sched") );
+      // the split needs at least one train and one test row
+      TORCH_CHECK( nsamp0_ == 0 || nsamp0_ >= 2,
+                   "--nsamp0 must be 0 or at least 2, got ", nsamp0_ );
+    }
+
+    double LR( int step ) const
+    {
+      if (step < int(warmup_))
+        return lr_ * double(step + 1) / double(warmup_);
+      if (!cosine_ || total_ <= int(warmup_))
+        return lr_;
+      auto t = std::min(1., double(step - warmup_) / double(total_ - warmup_));
+      return lr_ * (minlr_ + (1. - minlr_) * 0.5 * (1. + std::cos(M_PI * t)));
+    }
+
+    size_t Nsamp( int step ) const { return _Ramp(step, nsamp0_, nsamp_); }
+    size_t Nset( int step ) const { return _Ramp(step, nset0_, nset_); }
+
+    // Set the learning rate of all the parameter groups
+    void Apply( torch::optim::Optimizer& opt, int step ) const
+    {
+      for (auto& group : opt.param_groups())
+        group.options().set_lr(LR(step));
+    }
+
+    void Save( torch::serialize::OutputArchive& archive ) const
+    {
+      archive.write("sched", torch::tensor({lr_, minlr_, double(cosine_),
+                                            double(warmup_), double(total_),
+                                            double(ramp_), double(nsamp0_),
+                                            double(nset0_), double(nsamp_),
+                                            double(nset_)},
+                                           torch::kDouble));
+    }
+
+    // Settings of the run that wrote the checkpoint, if there are any
+    bool Load( torch::serialize::InputArchive& archive )
+    {
+      torch::Tensor t;
+      if (!archive.try_read("sched", t))
+        return false;
+      t = t.cpu();
+      auto v = t.accessor<double,1>();
+      lr_ = v[0]; minlr_ = v[1]; cosine_ = v[2] != 0.;
+      warmup_ = v[3]; total_ = v[4]; ramp_ = v[5];
+      nsamp0_ = v[6]; nset0_ = v[7];
+      if (t.numel() > 8) // older checkpoints have no final sizes
+      {
+        nsamp_ = v[8]; nset_ = v[9];
+      }
+      return true;
+    }
+
+    void Print( std::ostream& out = std::cout ) const
+    {
+      out << "Schedule: lr " << lr_ << (cosine_ ? " cosine" : " constant")
+          << " warmup " << warmup_ << " of " << total_ << " steps";
+      if (ramp_ > 0)
+        out << ", curriculum nsamp " << nsamp0_ << "->" << nsamp_
+            << " nset " << nset0_ << "->" << nset_ << " over " << ramp_
+            << " steps";
+      out << std::endl;
+    }
+
+  private:
+    double lr_, minlr_;
+    bool cosine_;
+    size_t warmup_;
+    int total_;
+    size_t ramp_, nsamp_, nset_, nsamp0_, nset0_;
+
+    size_t _Ramp( int step, size_t from, size_t to ) const
+    {
+      if (ramp_ == 0 || step >= int(ramp_) || from == 0)
+        return to;
+      return from + size_t(std::round(double(to - from) * step / ramp_));
+    }
+  };
+}
@@ -0,0 +1,256 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Many SimplePFN checkpoints resident in one inference
+  * process. The registry keeps the models that were used last under a cap
+  * on the bytes of their weights (least recently used goes first), every
+  * handle shares the weights of its model and all of them run on the one
+  * intra-op thread pool of the process (see pfn_init).
+  *
+  * It is a cache of loaded models: a miss reads the checkpoint (from the
+  * page cache if it was read recently) into freshly allocated weights, a
+  * hit hands out the resident ones. A checkpoint that was replaced on disk
+  * is picked up the next time its model is loaded. A model is loaded only
+  * once even if many threads ask for it at the same time, the others wait
+  * for it.
+*/
+#pragma once
+#include <chrono>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace serve
+{
+  struct Stats
+  {
+    size_t hits = 0, misses = 0, evictions = 0;
+    size_t resident = 0;                  // models in the registry
+    int64_t bytes = 0;                    // of their weights
+    double load = 0., last = 0., max = 0.;// seconds of the loads
+
+    double HitRate( ) const
+    {
+      return hits + misses > 0 ? double(hits) / double(hits + misses) : 0.;
+    }
+  };
+
+  // Bytes of the parameters and buffers of a model
+  template<class MODEL>
+  int64_t bytes( const MODEL& model )
+  {
+    int64_t res = 0;
+    for (const auto& p : model->parameters())
+      res += p.numel() * p.element_size();
+    for (const auto& b : model->buffers())
+      res += b.numel() * b.element_size();
+    return res;
+  }
+
+  class Registry
+  {
+  public:
+    // The model of a key, built (with the right configuration) and not
+    // loaded yet
+    using Make = std::function<model::SimplePFN()>;
+
+    // capacity: bytes of weights that stay resident
+    explicit Registry( int64_t capacity ) : cap_(capacity)
+    {
+      TORCH_CHECK( cap_ > 0, "Registry capacity must be positive." );
+    }
+
+    // The model of key (the checkpoint at path), loaded if it is not
+    // resident. The weights are shared with everyone that asked for key.
+    model::SimplePFN Get( const std::string& key,
+                          const std::filesystem::path& path, const Make& make )
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto it = slots_.find(key);
+      if (it != slots_.end())
+      {
+        stats_.hits++;
+        _meters().hits.Add();
+        lru_.splice(lru_.begin(), lru_, it->second.pos);
+        auto model = it->second.model;
+        lock.unlock();
+        return model.get();
+      }
+
+      stats_.misses++;
+      _meters().misses.Add();
+      std::promise<model::SimplePFN> promise;
+      lru_.push_front(key);
+      slots_[key] = Slot{promise.get_future().share(), 0, lru_.begin()};
+      lock.unlock();
+
+      model::SimplePFN net{nullptr};
+      auto t0 = std::chrono::high_resolution_clock::now();
+      try
+      {
+        net = make();
+        torch::serialize::InputArchive archive;
+        archive.load_from(path.string());
+        net->load(archive);
+        net->to(DEVICE);
+        net->eval();
+      }
+      catch (...)
+      {
+        promise.set_exception(std::current_exception());
+        lock.lock();
+        lru_.erase(slots_[key].pos);
+        slots_.erase(key);
+        throw;
+      }
+      std::chrono::duration<double> dt =
+        std::chrono::high_resolution_clock::now() - t0;
+      promise.set_value(net);
+
+      lock.lock();
+      _meters().load.Observe(dt.count());
+      stats_.load += dt.count();
+      stats_.last = dt.count();
+      stats_.max = std::max(stats_.max, dt.count());
+      auto& slot = slots_[key];
+      slot.bytes = bytes(net);
+      bytes_ += slot.bytes;
+      _Evict();
+      return net;
+    }
+
+    // Drop every resident model
+    void Clear( )
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto it = lru_.begin(); it != lru_.end(); )
+      {
+        auto& slot = slots_[*it];
+        if (slot.bytes == 0) // still loading
+        {
+          it++;
+          continue;
+        }
+        bytes_ -= slot.bytes;
+        slots_.erase(*it);
+        it = lru_.erase(it);
+      }
+      _meters().bytes.Set(bytes_);
+    }
+
+    Stats GetStats( )
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto res = stats_;
+      res.resident = slots_.size();
+      res.bytes = bytes_;
+      return res;
+    }
+
+  private:
+    struct Slot
+    {
+      std::shared_future<model::SimplePFN> model;
+      int64_t bytes = 0;                  // 0 while loading
+      std::list<std::string>::iterator pos;
+    };
+
+    struct Meters
+    {
+      metrics::Counter hits, misses, evictions;
+      metrics::Gauge bytes;
+      metrics::Histogram load;
+    };
+
+    int64_t cap_, bytes_ = 0;
+    std::mutex mutex_;
+    std::list<std::string> lru_;          // most recent first
+    std::map<std::string,Slot> slots_;
+    Stats stats_;
+
+    // Shared by all the registries of the process
+    static const Meters& _meters( )
+    {
+      static const Meters m = []
+      {
+        auto& reg = metrics::Registry::GetInstance();
+        return Meters{
+          reg.MakeCounter("pfn_registry_hits_total", "Resident model found"),
+          reg.MakeCounter("pfn_registry_misses_total", "Model loaded"),
+          reg.MakeCounter("pfn_registry_evictions_total", "Model dropped"),
+          reg.MakeGauge("pfn_registry_bytes", "Bytes of resident weights"),
+          reg.MakeHistogram("pfn_registry_load_seconds", "Model loads") };
+      }();
+      return m;
+    }
+
+    // Least recently used first, until the rest fits (the newest model
+    // stays even if it alone is over the cap)
+    void _Evict( )
+    {
+      auto it = lru_.end();
+      while (bytes_ > cap_ && it != lru_.begin())
+      {
+        it--;
+        if (it == lru_.begin())
+          break;
+        auto& slot = slots_[*it];
+        if (slot.bytes == 0)
+          continue;
+        bytes_ -= slot.bytes;
+        stats_.evictions++;
+        _meters().evictions.Add();
+        slots_.erase(*it);
+        it = lru_.erase(it);
+      }
+      _meters().bytes.Set(bytes_);
+    }
+  };
+
+  // Time to a usable model of the checkpoint at path: load_checkpoint,
+  // a registry hit, and a registry miss (two keys that
+  // evict each other, so every Get loads).
+  template<class MAKE>
+  void Check( const std::filesystem::path& path, const MAKE& make,
+              int reps = 10, std::ostream& out = std::cout )
+  {
+    auto time = [reps]( const std::function<void()>& fn )
+    {
+      auto t0 = std::chrono::high_resolution_clock::now();
+      for (int i = 0; i < reps; i++)
+        fn();
+      std::chrono::duration<double,std::milli> dt =
+        std::chrono::high_resolution_clock::now() - t0;
+      return dt.count() / reps;
+    };
+
+    auto cold = time([&]
+    {
+      auto model = make();
+      load_checkpoint(path, model);
+      model->to(DEVICE);
+    });
+
+    Registry hot(int64_t(1) << 40);
+    hot.Get("a", path, make);
+    auto hit = time([&]{ hot.Get("a", path, make); });
+
+    Registry tight(1);
+    int turn = 0;
+    tight.Get("b", path, make);               // the file is in the cache
+    auto miss = time([&]{ tight.Get(turn++ % 2 ? "b" : "a", path, make); });
+    auto stats = tight.GetStats();
+
+    out << std::string(50, '-') << "\n" << std::left << std::fixed
+        << std::setprecision(3)
+        << std::setw(30) << "load_checkpoint [ms]" << cold << "\n"
+        << std::setw(30) << "registry miss [ms]" << miss << "\n"
+        << std::setw(30) << "registry hit [ms]" << hit << "\n"
+        << std::setw(30) << "weights [MB]" << stats.bytes / double(1 << 20)
+        << "\n" << std::string(50, '-') << "\n";
+  }
+}
@@ -0,0 +1,352 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Hyperparameter sweeps on a single node. Every trial is this
+  * same program started with its own flags, cores and path:
+  *
+  *   --sweep "lr=0.001,0.0003;nset=20,40"   grid over registered flags
+  *   --search random --trials 8              8 random points of the grid
+  *   --slots 4                               trials running at once
+  *
+  * The cores (--cores, or all of them) are split evenly among the slots and
+  * each trial gets the same slot for its life, so nothing is oversubscribed.
+  * Trials with the same prior settings (--prior included, the borders are
+  * sampled from the prior of the trial) share one border file. A trial whose
+  * recent loss is worse than the median of the others at the same step is
+  * killed (median stopping, after --killafter steps). The result is written
+  * to <path>/summary.txt. With --metrics every trial dumps its own to
+  * <trial>/metrics.prom.
+  * POSIX only.
+*/
+#pragma once
+#include <csignal>
+#include <map>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace sweep
+{
+  using Point = std::vector<std::pair<std::string,std::string>>;
+
+  // The priors a trial can pick with --prior, by name
+  using Priors = std::map<std::string, prior::Tasks*>;
+
+  struct Trial
+  {
+    Point point;
+    std::string name;
+    std::filesystem::path path;
+    pid_t pid = -1;
+    int slot = -1;
+    std::string status = "waiting";
+    std::vector<double> loss;  // one per step, read from the progress log
+    double seconds = 0.;
+  };
+
+  // "lr=0.1,0.01;nset=20,40" -> all the points of the grid
+  std::vector<Point> grid( const std::string& spec, const CLIStore& conf )
+  {
+    std::vector<Point> points = {{}};
+    std::stringstream ss(spec);
+    std::string axis;
+    while (std::getline(ss, axis, ';'))
+    {
+      auto eq = axis.find('=');
+      TORCH_CHECK( eq != std::string::npos, "Sweep axis without '=': ", axis );
+      auto key = axis.substr(0, eq);
+      TORCH_CHECK( conf.Has(key), "Sweep over an unknown flag: ", key );
+
+      std::vector<std::string> values;
+      std::stringstream vs(axis.substr(eq + 1));
+      std::string v;
+      while (std::getline(vs, v, ','))
+        values.push_back(v);
+
+      std::vector<Point> next;
+      for (const auto& p : points)
+        for (const auto& v : values)
+        {
+          auto q = p;
+          q.emplace_back(key, v);
+          next.push_back(q);
+        }
+      points = next;
+    }
+    return points;
+  }
+
+  // Same naming as CLIStore::GenName
+  std::string name( const Point& point, const CLIStore& conf )
+  {
+    std::string res;
+    for (const auto& [key, value] : point)
+      res += (res.empty() ? "" : "-") + conf.Sanitize(key) + "_" +
+             conf.Sanitize(value);
+    return res;
+  }
+
+  // Value of a flag in a trial, the override or the one of this run. Read
+  // the way CLIStore reads it, so parent and child agree.
+  template<class T>
+  T value( const Point& point, const std::string& key, const CLIStore& conf )
+  {
+    for (const auto& [k, v] : point)
+      if (k == key)
+      {
+        if constexpr (std::is_same_v<T, bool>)
+          return v == "true" || v == "1";
+        else
+        {
+          std::stringstream ss(v);
+          T res;
+          ss >> res;
+          return res;
+        }
+      }
+    return conf.Get<T>(key);
+  }
+
+  // Border file shared by the trials with these prior settings, computed
+  // here once
+  std::filesystem::path borders( const Priors& priors, const Point& point,
+                                 const CLIStore& conf,
+                                 const std::filesystem::path& dir )
+  {
+    auto which = value<std::string>(point, "prior", conf);
+    auto it = priors.find(which);
+    TORCH_CHECK( it != priors.end(), "Unknown prior ", which );
+    auto nsamp = value<size_t>(point, "nsamp", conf);
+    auto nfeat = value<size_t>(point, "nfeat", conf);
+    auto nbin = value<size_t>(point, "nbin", conf);
+    auto prep = value<bool>(point, "prep", conf);
+
+    auto file = dir / ("borders-" + conf.Sanitize(which) + "-s" +
+                       std::to_string(nsamp) + "-f" +
+                       std::to_string(nfeat) + "-b" + std::to_string(nbin) +
+                       "-p" + std::to_string(prep) + ".pt");
+    if (!std::filesystem::exists(file))
+    {
+      PFN_LOG("Computing the borders " << file);
+      torch::save(it->second->Border(nsamp, nfeat, nbin, prep),
+                  file.string());
+    }
+    return file;
+  }
+
+  // Start the trial on the given cores
+  pid_t launch( int argc, char** argv, const Trial& trial,
+                const std::vector<int>& cores,
+                const std::filesystem::path& border, bool metrics )
+  {
+    std::vector<std::string> args(argv, argv + argc);
+    for (const auto& [key, value] : trial.point)
+    {
+      args.push_back("--" + key);
+      args.push_back(value);
+    }
+    std::string list;
+    for (int c : cores)
+      list += (list.empty() ? "" : ",") + std::to_string(c);
+    // the later flags win, the sweep flags are switched off for the child
+    std::vector<std::string> extra = {
+      "--sweep", "", "--autotune", "false",
+      "--cores", list, "--intra", std::to_string(cores.size()),
+      "--path", trial.path.string(),
+      "--borders", border.string(),
+      "--log", (trial.path / "progress.txt").string() };
+    args.insert(args.end(), extra.begin(), extra.end());
+    if (metrics)
+    {
+      args.push_back("--metrics");
+      args.push_back((trial.path / "metrics").string());
+    }
+
+    std::vector<char*> cargs;
+    for (auto& a : args)
+      cargs.push_back(a.data());
+    cargs.push_back(nullptr);
+
+    // the child may only make async-signal-safe calls until the exec (the
+    // parent has threads, one of them may hold a stdio lock), so the path
+    // is prepared here and stdio is never touched there
+    auto out = (trial.path / "stdout.txt").string();
+    pid_t pid = fork();
+    TORCH_CHECK( pid >= 0, "Could not fork a trial." );
+    if (pid == 0)
+    {
+      int fd = ::open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0 ||
+                    dup2(fd, STDERR_FILENO) < 0)
+        _exit(126);
+      if (fd > STDERR_FILENO)
+        ::close(fd);
+      execv("/proc/self/exe", cargs.data());
+      _exit(127);
+    }
+    return pid;
+  }
+
+  // Read the progress log of the trial: "step loss seconds" per line
+  void poll( Trial& trial )
+  {
+    std::ifstream file(trial.path / "progress.txt");
+    int step;
+    double loss, seconds;
+    trial.loss.clear();
+    while (file >> step >> loss >> seconds)
+    {
+      trial.loss.push_back(loss);
+      trial.seconds = seconds;
+    }
+  }
+
+  // Mean loss of the last (at most) window steps up to step
+  double recent( const Trial& trial, size_t step, size_t window = 10 )
+  {
+    auto end = std::min(step, trial.loss.size());
+    auto begin = end > window ? end - window : 0;
+    double res = 0.;
+    for (auto i = begin; i < end; i++)
+      res += trial.loss[i];
+    return end > begin ? res / (end - begin) : 0.;
+  }
+
+  // Median stopping rule
+  bool poor( const Trial& trial, const std::vector<Trial>& trials,
+             size_t after )
+  {
+    const auto step = trial.loss.size();
+    if (step < after)
+      return false;
+
+    std::vector<double> others;
+    for (const auto& t : trials)
+      if (&t != &trial && t.loss.size() >= step)
+        others.push_back(recent(t, step));
+    if (others.size() < 2)
+      return false;
+
+    std::nth_element(others.begin(), others.begin() + others.size() / 2,
+                     others.end());
+    return recent(trial, step) > others[others.size() / 2];
+  }
+
+  void summary( const std::vector<Trial>& trials, std::ostream& out )
+  {
+    out << std::string(80, '-') << "\n" << std::left
+        << std::setw(40) << "trial"
+        << std::setw(10) << "status"
+        << std::setw(10) << "steps"
+        << std::setw(10) << "loss"
+        << std::setw(10) << "steps/s" << "\n"
+        << std::string(80, '-') << "\n";
+    for (const auto& t : trials)
+      out << std::left << std::fixed << std::setprecision(4)
+          << std::setw(40) << t.name
+          << std::setw(10) << t.status
+          << std::setw(10) << t.loss.size()
+          << std::setw(10) << recent(t, t.loss.size())
+          << std::setw(10) << std::setprecision(2)
+          << (t.seconds > 0. ? t.loss.size() / t.seconds : 0.) << "\n";
+    out << std::string(80, '-') << "\n";
+  }
+
+  int Run( int argc, char** argv, const Priors& priors, const CLIStore& conf )
+  {
+    const auto dir = conf.Get<std::filesystem::path>("path");
+    std::filesystem::create_directories(dir);
+
+    auto points = grid(conf.Get<std::string>("sweep"), conf);
+    auto ntrial = conf.Get<size_t>("trials");
+    if (conf.Get<std::string>("search") == "random")
+    {
+      std::mt19937_64 gen(conf.Get<size_t>("seed"));
+      std::shuffle(points.begin(), points.end(), gen);
+    }
+    if (ntrial > 0 && ntrial < points.size())
+      points.resize(ntrial);
+
+    // cores of each slot
+    auto all = runtime::parse_cores(conf.Get<std::string>("cores"));
+    if (all.empty())
+      for (unsigned c = 0; c < std::thread::hardware_concurrency(); c++)
+        all.push_back(c);
+    const auto nslot = std::max<size_t>(1, std::min({conf.Get<size_t>("slots"),
+                                                     all.size(),
+                                                     points.size()}));
+    const auto per = all.size() / nslot;
+    std::vector<std::vector<int>> slots(nslot);
+    for (size_t s = 0; s < nslot; s++)
+      slots[s].assign(all.begin() + s * per, all.begin() + (s + 1) * per);
+    std::vector<bool> busy(nslot, false);
+
+    std::vector<Trial> trials;
+    for (const auto& p : points)
+    {
+      Trial t;
+      t.point = p;
+      t.name = name(p, conf);
+      t.path = dir / t.name;
+      trials.push_back(t);
+    }
+    PFN_LOG("Sweep: " << trials.size() << " trials in " << nslot
+            << " slots of " << per << " cores");
+
+    const auto after = conf.Get<size_t>("killafter");
+    const bool metrics = !conf.Get<std::filesystem::path>("metrics").empty();
+    size_t next = 0, running = 0;
+    while (next < trials.size() || running > 0)
+    {
+      // fill the free slots
+      for (size_t s = 0; s < nslot && next < trials.size(); s++)
+        if (!busy[s])
+        {
+          auto& t = trials[next++];
+          std::filesystem::create_directories(t.path);
+          std::filesystem::remove(t.path / "progress.txt");
+          auto border = borders(priors, t.point, conf, dir);
+          t.pid = launch(argc, argv, t, slots[s], border, metrics);
+          t.slot = s;
+          t.status = "running";
+          busy[s] = true;
+          running++;
+        }
+
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+
+      for (auto& t : trials)
+      {
+        if (t.status != "running")
+          continue;
+        poll(t);
+
+        int wstatus;
+        if (waitpid(t.pid, &wstatus, WNOHANG) == t.pid)
+        {
+          poll(t);
+          t.status = WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0 ?
+                     "done" : "failed";
+          busy[t.slot] = false;
+          running--;
+        }
+        else if (after > 0 && poor(t, trials, after))
+        {
+          kill(t.pid, SIGTERM);
+          waitpid(t.pid, nullptr, 0);
+          t.status = "killed";
+          busy[t.slot] = false;
+          running--;
+        }
+      }
+    }
+
+    summary(trials, std::cout);
+    std::ofstream file(dir / "summary.txt");
+    summary(trials, file);
+    return 0;
+  }
+}
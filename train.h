@@ -8,12 +8,242 @@
 #include<optional> 
 #include<functional> 
 #include <chrono>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <thread>
 
 namespace train 
 {
+  // Forward and backward in micro batches of datasets (dim 1), the gradients
+  // add up to the ones of the full batch. Returns the (detached) loss.
+  template<class MODEL>
+  torch::Tensor Backward ( MODEL& model,
+                           const torch::Tensor& Xtrn,
+                           const torch::Tensor& ytrn,
+                           const torch::Tensor& Xtst,
+                           const torch::Tensor& ytst,
+                           size_t micro = 0, Arena* arena = nullptr )
+  {
+    const int64_t nset = Xtrn.size(1);
+    if (micro == 0 || int64_t(micro) >= nset)
+    {
+      auto loss = model( Xtrn,ytrn,Xtst,ytst,arena );
+      loss.backward();
+      return loss.detach();
+    }
+
+    auto total = torch::zeros({}, Xtrn.options());
+    for (int64_t s = 0; s < nset; s += micro)
+    {
+      auto n = std::min<int64_t>(micro, nset - s);
+      auto w = double(n) / double(nset);
+      auto loss = model( Xtrn.narrow(1,s,n), ytrn.narrow(1,s,n),
+                         Xtst.narrow(1,s,n), ytst.narrow(1,s,n), arena );
+      (loss * w).backward();
+      total += loss.detach() * w;
+    }
+    return total;
+  }
+
+  // One training batch (and the teacher's targets when distilling)
+  struct Batch
+  {
+    torch::Tensor Xtrn, ytrn, Xtst, ytst;
+    torch::Tensor target; // log-probabilities of the teacher
+  };
+
+  //---------------------------------------------------------------------------
+  // Validator : loss on a fixed held-out prior suite every --validate steps.
+  // The weights are copied into a shadow model (a plain copy_, no
+  // allocations) and it is evaluated on a worker thread (on --valcores if
+  // given) under InferenceMode while the training goes on. If the previous
+  // evaluation is still running the step is skipped. The curve goes to
+  // <path>/valid.txt and the best snapshot to <path>/best.pt.
+  //---------------------------------------------------------------------------
+  template<class MODEL>
+  class Validator
+  {
+  public:
+    template<class PRIOR>
+    Validator( const PRIOR& prior, const MODEL& model, const CLIStore& conf ) :
+      every_(conf.Get<size_t>("validate")),
+      target_(conf.Get<double>("target")),
+      path_(conf.Get<std::filesystem::path>("path")),
+      shadow_(model->loss->bins_.cpu(), model->dmodel_, model->nhead_,
+              model->nencoder_, model->nhid_, model->infeat_, model->hier_,
+              model->prep_, model->nshare_),
+      worker_(runtime::parse_cores(conf.Get<std::string>("valcores")))
+    {
+      shadow_->to(DEVICE);
+      shadow_->eval();
+
+      // the suite is the same on every run and leaves the training stream
+      // of random numbers alone
+      auto gen = at::detail::getDefaultCPUGenerator();
+      auto state = gen.get_state();
+      torch::manual_seed(conf.Get<size_t>("seed") + 1);
+      const auto nsamp = conf.Get<size_t>("nsamp");
+      for (size_t i = 0; i < conf.Get<size_t>("valsets"); i++)
+      {
+        auto sets = split( prior.Sample(conf.Get<size_t>("nset"), nsamp,
+                                        conf.Get<size_t>("nfeat")),
+                           nsamp / 2 );
+        suite_.push_back({std::get<0>(sets).to(DEVICE),
+                          std::get<2>(sets).to(DEVICE),
+                          std::get<1>(sets).to(DEVICE),
+                          std::get<3>(sets).to(DEVICE), {}});
+      }
+      gen.set_state(state);
+      start_ = std::chrono::high_resolution_clock::now();
+    }
+
+    // Call it after every optimizer step
+    void Step( const MODEL& model, int step )
+    {
+      if (every_ == 0 || step % every_ != 0)
+        return;
+      if (worker_.Pending() > 0)
+      {
+        skipped_++;
+        return;
+      }
+      _Snapshot(model);
+      std::chrono::duration<double> dt =
+        std::chrono::high_resolution_clock::now() - start_;
+      worker_.Submit([this, step, t = dt.count()]{ _Evaluate(step, t); });
+    }
+
+    // Block until the running evaluation is done
+    void Wait( )
+    {
+      while (worker_.Pending() > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    double Last( ) const { return last_; }
+
+    // First step (and the seconds since the start) at which the validation
+    // loss was <= --target, -1 if it never was
+    std::pair<int,double> Reach( ) const { return {reachstep_, reach_}; }
+    double Best( ) const { return best_; }
+    size_t Skipped( ) const { return skipped_; }
+    size_t Pending( ) { return worker_.Pending(); }
+
+  private:
+    size_t every_;
+    double target_;
+    std::filesystem::path path_;
+    MODEL shadow_;
+    std::vector<Batch> suite_;
+    std::atomic<double> last_{std::numeric_limits<double>::quiet_NaN()};
+    std::atomic<double> best_{std::numeric_limits<double>::infinity()};
+    size_t skipped_ = 0;
+    std::chrono::high_resolution_clock::time_point start_;
+    int reachstep_ = -1;
+    double reach_ = -1.;
+    runtime::Worker worker_; // last, it has to finish before the rest goes
+
+    void _Snapshot( const MODEL& model )
+    {
+      torch::NoGradGuard nograd;
+      auto src = model->named_parameters();
+      auto dst = shadow_->named_parameters();
+      for (const auto& p : src)
+        dst[p.key()].copy_(p.value());
+      auto bsrc = model->named_buffers();
+      auto bdst = shadow_->named_buffers();
+      for (const auto& b : bsrc)
+        bdst[b.key()].copy_(b.value());
+    }
+
+    // t: seconds from the start to the snapshot
+    void _Evaluate( int step, double t )
+    {
+      double loss = 0.;
+      {
+        c10::InferenceMode guard;
+        for (const auto& b : suite_)
+          loss += shadow_(b.Xtrn, b.ytrn, b.Xtst, b.ytst)
+                    .template item<double>();
+        loss /= suite_.size();
+      }
+      last_ = loss;
+      if (reachstep_ < 0 && loss <= target_)
+      {
+        reach_ = t;
+        reachstep_ = step;
+      }
+
+      std::ofstream(path_ / "valid.txt", std::ios::app)
+        << step << " " << loss << "\n";
+
+      if (loss < best_)
+      {
+        best_ = loss;
+        torch::serialize::OutputArchive archive;
+        shadow_->save(archive);
+        archive.write("epoch", torch::tensor(step));
+        archive.save_to(path_ / "best.pt");
+      }
+    }
+  };
+
+  // Training metrics (see metrics.h), made once for all the runs
+  struct Meters
+  {
+    metrics::Counter steps, datasets;
+    metrics::Gauge loss, lr, stepsps, setsps, sampq, validq;
+    metrics::Histogram sample, transfer, backward, update;
+  };
+
+  const Meters& meters( )
+  {
+    static const Meters m = []
+    {
+      auto& reg = metrics::Registry::GetInstance();
+      const auto& tracker = mem::Tracker::GetInstance();
+      reg.MakeCallback("pfn_alloc_bytes", "Bytes held by the tracking "
+                       "allocator", [&tracker]{ return tracker.Bytes(); });
+      reg.MakeCallback("pfn_alloc_peak_bytes", "Peak of pfn_alloc_bytes",
+                       [&tracker]{ return tracker.Peak(); });
+      const std::string phase = "Seconds of a phase of a training step";
+      return Meters{
+        reg.MakeCounter("pfn_steps_total", "Training steps"),
+        reg.MakeCounter("pfn_datasets_total", "Datasets trained on"),
+        reg.MakeGauge("pfn_loss", "Training loss of the last step"),
+        reg.MakeGauge("pfn_lr", "Learning rate of the last step"),
+        reg.MakeGauge("pfn_steps_per_second", "Of the last step"),
+        reg.MakeGauge("pfn_datasets_per_second", "Of the last step"),
+        reg.MakeGauge("pfn_queue_depth", "Pending jobs", "queue=\"sampler\""),
+        reg.MakeGauge("pfn_queue_depth", "Pending jobs",
+                      "queue=\"validator\""),
+        reg.MakeHistogram("pfn_phase_seconds", phase, metrics::exp_bounds(),
+                          "phase=\"sample\""),
+        reg.MakeHistogram("pfn_phase_seconds", phase, metrics::exp_bounds(),
+                          "phase=\"transfer\""),
+        reg.MakeHistogram("pfn_phase_seconds", phase, metrics::exp_bounds(),
+                          "phase=\"backward\""),
+        reg.MakeHistogram("pfn_phase_seconds", phase, metrics::exp_bounds(),
+                          "phase=\"update\"") };
+    }();
+    return m;
+  }
+
+  // What a training run achieved, reach is the wall time (s) until the
+  // validation loss first got to --target (negative if it did not)
+  struct Summary
+  {
+    double seconds = 0.;
+    double best = std::numeric_limits<double>::infinity();
+    double reach = -1.;
+    int reachstep = -1;
+  };
+
   template<class PRIOR, class MODEL, class OPT, class DTYPE=float>
-  void Simple ( const PRIOR& prior, MODEL& model, OPT& opt,
-                const CLIStore& conf, int epoch_ = 0, int check = 10 )
+  Summary Simple ( const PRIOR& prior, MODEL& model, OPT& opt,
+                   const CLIStore& conf, const sched::Schedule& schedule,
+                   int epoch_ = 0, int check = 10 )
   {
 
     model->to(DEVICE);
@@ -23,38 +253,134 @@ namespace train
     auto t_total_start = std::chrono::high_resolution_clock::now();
     double cumulative_epoch_time = 0.0;
 
+    // With --arena the per step tensors live in buffers that are reused. The
+    // prior samples alternate between two arenas, so a prefetched batch never
+    // overwrites the one that is being trained on.
+    const bool use_arena = conf.Get<bool>("arena");
+    Arena arena, pool[2];
+    size_t turn = 0;
+
+    // With --varfeat every batch has its own number of columns in
+    // [1, nfeat], so that the model learns to serve narrower tables as well.
+    auto width = [&]( ) -> int
+    {
+      auto nfeat = conf.Get<size_t>("nfeat");
+      if (!conf.Get<bool>("varfeat"))
+        return nfeat;
+      return torch::randint(1, nfeat + 1, 1).item<int>();
+    };
+
+    // The batch of a step, its size follows the curriculum
+    auto draw = [&]( int step )
+    {
+      if (use_arena)
+        return prior.Sample(schedule.Nset(step), schedule.Nsamp(step),
+                            width(), pool[turn++ % 2]);
+      return prior.Sample(schedule.Nset(step), schedule.Nsamp(step), width());
+    };
+
+    // Allocation counts per step, if the tracking allocator is installed
+    const auto& tracker = mem::Tracker::GetInstance();
+
+    // The validation suite is drawn first, with the generator reseeded and
+    // restored, before a sampler thread could draw from it at the same time
+    std::unique_ptr<Validator<MODEL>> validator;
+    if (conf.Get<size_t>("validate") > 0)
+      validator = std::make_unique<Validator<MODEL>>(prior, model, conf);
+
+    // With dedicated sampler cores the next batch is drawn there, while the
+    // current one is trained on. Both threads use the default generator, the
+    // interleaving of their draws (and so the run) is not reproducible.
+    auto sampcores = runtime::parse_cores(conf.Get<std::string>("sampcores"));
+    std::unique_ptr<runtime::Worker> sampler;
+    std::future<decltype(draw(0))> next;
+    if (!sampcores.empty())
+    {
+      PFN_LOG("Sampling on its own cores, the run is not reproducible.");
+      sampler = std::make_unique<runtime::Worker>(sampcores);
+      next = sampler->Submit([&draw, epoch_]{ return draw(epoch_); });
+    }
+
+    // --log: one "step loss seconds" line per step, for the sweeps
+    std::ofstream log;
+    if (!conf.Get<std::filesystem::path>("log").empty())
+      log.open(conf.Get<std::filesystem::path>("log"), std::ios::app);
+
+    // Seconds since the last lap into h, the phases of a step
+    const auto& meter = meters();
+    auto t_lap = std::chrono::high_resolution_clock::now();
+    auto lap = [&t_lap]( const metrics::Histogram& h )
+    {
+      auto now = std::chrono::high_resolution_clock::now();
+      h.Observe(std::chrono::duration<double>(now - t_lap).count());
+      t_lap = now;
+    };
+
     for ( int epoch=0; epoch <= epochs; epoch++)
     {
       auto t_epoch_start = std::chrono::high_resolution_clock::now();
+      t_lap = t_epoch_start;
+      auto nalloc = tracker.Count();
+      const int step = epoch + epoch_;
 
-      auto res = prior.Sample(conf.Get<size_t>("nset"),
-                              conf.Get<size_t>("nsamp"),
-                              conf.Get<size_t>("nfeat"));
+      decltype(draw(0)) res;
+      if (sampler)
+      {
+        res = next.get();
+        if (epoch < epochs)
+          next = sampler->Submit([&draw, step]{ return draw(step + 1); });
+      }
+      else
+        res = draw(step);
+      lap(meter.sample);
 
-      auto sets = split( res,
-        torch::randint(0, conf.Get<size_t>("nsamp") - 1, 1).item<int>() );
+      // the split runs where the model is, the batch goes over as it is
+      const auto nsamp = std::get<0>(res).size(0);
+      std::get<0>(res) = std::get<0>(res).to(DEVICE);
+      std::get<1>(res) = std::get<1>(res).to(DEVICE);
+      auto sets = use_arena ?
+        split( res, arena.Get("ntst", {1}, torch::kLong)
+              .random_(1, nsamp).item<int>(), arena ) :
+        split( res, torch::randint(1, nsamp, 1).item<int>() );
 
       auto Xtrn = std::get<0>(sets);
       auto Xtst = std::get<1>(sets);
       auto ytrn = std::get<2>(sets);
       auto ytst = std::get<3>(sets);
-
-      Xtrn = Xtrn.to(DEVICE); ytrn = ytrn.to(DEVICE);
-      Xtst = Xtst.to(DEVICE); ytst = ytst.to(DEVICE);
+      auto ndata = tracker.Count() - nalloc;
+      lap(meter.transfer);
 
       model->train();
       opt.zero_grad();
+      schedule.Apply(opt, step);
 
-      auto loss = model( Xtrn,ytrn,Xtst,ytst );
-
-      loss.backward();
+      auto loss = Backward( model, Xtrn, ytrn, Xtst, ytst,
+                            conf.Get<size_t>("micro"),
+                            use_arena ? &arena : nullptr );
+      lap(meter.backward);
       opt.step();
+      lap(meter.update);
+      auto nstep = tracker.Count() - nalloc;
+      if (validator)
+        validator->Step(model, step);
 
       auto t_epoch_end = std::chrono::high_resolution_clock::now();
       std::chrono::duration<double> epoch_time = t_epoch_end - t_epoch_start;
 
       cumulative_epoch_time += epoch_time.count();
 
+      meter.steps.Add();
+      meter.datasets.Add(Xtrn.size(1));
+      meter.loss.Set(loss.template item<DTYPE>());
+      meter.lr.Set(schedule.LR(step));
+      meter.stepsps.Set(1. / epoch_time.count());
+      meter.setsps.Set(Xtrn.size(1) / epoch_time.count());
+      meter.sampq.Set(sampler ? sampler->Pending() : 0);
+      meter.validq.Set(validator ? validator->Pending() : 0);
+      if (log)
+        log << step << " " << loss.template item<DTYPE>() << " "
+            << cumulative_epoch_time << std::endl;
+
       auto avg_epoch_time =
         cumulative_epoch_time / static_cast<DTYPE>(epoch + 1);
 
@@ -72,10 +398,17 @@ namespace train
                 << epoch_time.count() << " s"
                 << "  ETA: "
                 << format_time_dhms(remaining_time)
-                << std::flush;
+                << "  LR: " << std::scientific << std::setprecision(2)
+                << schedule.LR(step) << std::fixed
+                << "  N: " << nsamp << "x" << Xtrn.size(1);
+      if (tracker.Installed())
+        std::cout << "  Allocs: " << ndata << " data / " << nstep << " step";
+      if (validator)
+        std::cout << "  Valid: " << std::setprecision(6) << validator->Last();
+      std::cout << std::flush;
       if (epoch % check == 0 && epoch != 0)
-        save_checkpoint(conf.Get<std::filesystem::path>("path"),
-                        model, epoch+epoch_);
+        ckpt::Save(conf.Get<std::filesystem::path>("path"), model, opt,
+                   schedule, step, conf);
     }
 
     auto t_total_end = std::chrono::high_resolution_clock::now();
@@ -85,7 +418,170 @@ namespace train
               << format_time_dhms(total_time.count())
               << "\n";
 
+    Summary summary;
+    summary.seconds = total_time.count();
+    if (validator)
+    {
+      validator->Wait();
+      std::cout << "Best validation loss: " << std::setprecision(6)
+                << validator->Best() << " (" << validator->Skipped()
+                << " evaluations skipped)\n";
+      summary.best = validator->Best();
+      std::tie(summary.reachstep, summary.reach) = validator->Reach();
+    }
+    return summary;
   }
-}
 
+  //---------------------------------------------------------------------------
+  // Distillation : a small student learns the predictive distribution of a
+  // (large) teacher on the prior batches. The loss is
+  //   alpha * KL(teacher || student) + (1 - alpha) * Riemann loss
+  // Both need the same borders and flat heads. The teacher runs on a worker
+  // thread (on --sampcores if given), one batch ahead of the student.
+  //---------------------------------------------------------------------------
+  template<class PRIOR, class MODEL, class OPT, class DTYPE=float>
+  void Distill ( const PRIOR& prior, MODEL& teacher, MODEL& student, OPT& opt,
+                 const CLIStore& conf, const std::filesystem::path& path,
+                 int check = 10 )
+  {
+    TORCH_CHECK( !teacher->hier_ && !student->hier_,
+                 "Distillation needs the flat Riemann heads." );
+    TORCH_CHECK( torch::equal(teacher->loss->bins_.cpu(),
+                              student->loss->bins_.cpu()),
+                 "Teacher and student borders differ." );
+
+    teacher->to(DEVICE); teacher->eval();
+    student->to(DEVICE);
+
+    const auto epochs = conf.Get<int>("epochs");
+    const auto nsamp = conf.Get<size_t>("nsamp");
+    const auto alpha = conf.Get<double>("alpha");
+
+    auto draw = [&]( )
+    {
+      auto sets = split( prior.Sample(conf.Get<size_t>("nset"), nsamp,
+                                      conf.Get<size_t>("nfeat")),
+                         torch::randint(1, nsamp, 1).item<int>() );
+      Batch b{std::get<0>(sets).to(DEVICE), std::get<2>(sets).to(DEVICE),
+              std::get<1>(sets).to(DEVICE), std::get<3>(sets).to(DEVICE), {}};
+      // no InferenceMode here, the targets are used in the student's graph
+      torch::NoGradGuard nograd;
+      b.target = torch::log_softmax(teacher->logits(b.Xtrn, b.ytrn, b.Xtst),
+                                    -1);
+      return b;
+    };
+
+    // the learning rate follows --sched as in Simple, the checkpoints
+    // carry the schedule with the rest of the training state
+    sched::Schedule schedule(conf, epochs);
+
+    runtime::Worker worker(
+        runtime::parse_cores(conf.Get<std::string>("sampcores")));
+    auto next = worker.Submit(draw);
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int epoch = 0; epoch <= epochs; epoch++)
+    {
+      auto b = next.get();
+      if (epoch < epochs)
+        next = worker.Submit(draw);
+
+      student->train();
+      schedule.Apply(opt, epoch);
+      opt.zero_grad();
+
+      auto out = student->logits(b.Xtrn, b.ytrn, b.Xtst);
+      auto kl = (b.target.exp() * (b.target - torch::log_softmax(out, -1)))
+                  .sum(-1).mean();
+      auto y = student->prep_ ?
+        prep::target(b.ytst, prep::fit(b.Xtrn, b.ytrn)) : b.ytst;
+      auto ce = student->loss(out, y);
+      auto loss = alpha * kl + (1. - alpha) * ce;
+      loss.backward();
+      opt.step();
+
+      std::cout << "\rEpoch ["
+                << std::setw(3) << epoch << "/"
+                << std::setw(3) << epochs << "] "
+                << "KL: " << std::setw(10)
+                << std::fixed << std::setprecision(6)
+                << kl.template item<DTYPE>()
+                << "  Loss: " << std::setw(10) << ce.template item<DTYPE>()
+                << std::flush;
+      if (epoch % check == 0 && epoch != 0)
+        ckpt::Save(path, student, opt, schedule, epoch, conf);
+    }
+
+    std::chrono::duration<DTYPE> total = 
+      std::chrono::high_resolution_clock::now() - t0;
+    std::cout << "\nTotal distillation time: "
+              << format_time_dhms(total.count()) << "\n";
+  }
+
+  // Accuracy vs latency of the teacher and the students on the same
+  // held-out prior batches: NLL of the predictive density (in the original
+  // scale of the target), MAE of the mean and the inference time of a batch.
+  template<class PRIOR, class MODEL>
+  void Tradeoff ( const PRIOR& prior, std::vector<std::string> names,
+                  std::vector<MODEL> models, const CLIStore& conf,
+                  int nbatch = 10, std::ostream& out = std::cout )
+  {
+    const auto nsamp = conf.Get<size_t>("nsamp");
+    std::vector<Batch> batches;
+    for (int i = 0; i < nbatch; i++)
+    {
+      auto sets = split( prior.Sample(conf.Get<size_t>("nset"), nsamp,
+                                      conf.Get<size_t>("nfeat")),
+                         nsamp / 2 );
+      batches.push_back({std::get<0>(sets).to(DEVICE),
+                         std::get<2>(sets).to(DEVICE),
+                         std::get<1>(sets).to(DEVICE),
+                         std::get<3>(sets).to(DEVICE), {}});
+    }
+
+    out << std::string(62, '-') << "\n" << std::left
+        << std::setw(14) << "model"
+        << std::setw(12) << "params"
+        << std::setw(12) << "nll"
+        << std::setw(12) << "mae"
+        << std::setw(12) << "time [ms]" << "\n"
+        << std::string(62, '-') << "\n";
 
+    torch::NoGradGuard nograd;
+    for (size_t m = 0; m < models.size(); m++)
+    {
+      auto& model = models[m];
+      model->to(DEVICE); model->eval();
+
+      double nll = 0., mae = 0.;
+      for (auto& b : batches)
+      {
+        auto logits = model->logits(b.Xtrn, b.ytrn, b.Xtst);
+        dist::Predictive res;
+        if (model->prep_)
+        {
+          auto s = prep::fit(b.Xtrn, b.ytrn);
+          res = prep::invert(model->loss->predict_distribution(logits,
+                               c10::nullopt, prep::target(b.ytst, s), 0.), s);
+        }
+        else
+          res = model->loss->predict_distribution(logits, c10::nullopt,
+                                                  b.ytst, 0.);
+        nll += res.nll.mean().template item<double>();
+        mae += (model(b.Xtrn, b.ytrn, b.Xtst, c10::nullopt) 
+                - b.ytst.squeeze(-1)).abs().mean().template item<double>();
+      }
+      auto& b = batches[0];
+      auto t = bench::_time([&]{ model(b.Xtrn, b.ytrn, b.Xtst,
+                                       c10::nullopt); });
+
+      out << std::left << std::fixed << std::setprecision(4)
+          << std::setw(14) << names[m]
+          << std::setw(12) << nparams(*model)
+          << std::setw(12) << nll / nbatch
+          << std::setw(12) << mae / nbatch
+          << std::setw(12) << std::setprecision(3) << t << "\n";
+    }
+    out << std::string(62, '-') << "\n";
+  }
+}
@@ -0,0 +1,182 @@
+/*
+  * Author: Ozgur Taylan Turan
+  * Date: 19 October 2026
+  * Description: Startup auto-tuner (--autotune). Short timed training steps
+  * over a grid of intra-op threads and micro-batch sizes, the fastest one
+  * (in samples/s) wins. The threads go up to the cores this process may run
+  * on, and an --intra given by the user is kept (only the micro-batch is
+  * searched then). The result is cached per host and model shape so the
+  * next run starts tuned right away.
+  *
+*/
+#pragma once
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+namespace tune
+{
+  struct Setting
+  {
+    int intra = 0;
+    size_t micro = 0;
+    double rate = 0.;  // samples/s
+  };
+
+  template<class MODEL>
+  std::string Key( const MODEL& model, const CLIStore& conf )
+  {
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+
+    std::ostringstream oss;
+    oss << host << "-" << DEVICE.str()
+        << "-d" << model->dmodel_ << "-h" << model->nhead_
+        << "-e" << model->nencoder_ << "-f" << model->nhid_
+        << "-b" << model->nbin_ << "-t" << model->hier_
+        << "-s" << conf.Get<size_t>("nsamp")
+        << "-n" << conf.Get<size_t>("nset")
+        << "-x" << conf.Get<size_t>("nfeat")
+        << "-i" << conf.Get<int>("intra");
+    return oss.str();
+  }
+
+  // The cache is a text file with lines of: key intra micro rate
+  bool Lookup( const std::filesystem::path& path, const std::string& key,
+               Setting& res )
+  {
+    std::ifstream file(path);
+    std::string k;
+    Setting s;
+    bool found = false;
+    while (file >> k >> s.intra >> s.micro >> s.rate)
+      if (k == key)
+      {
+        res = s;      // the last entry wins
+        found = true;
+      }
+    return found;
+  }
+
+  void Store( const std::filesystem::path& path, const std::string& key,
+              const Setting& res )
+  {
+    std::ofstream file(path, std::ios::app);
+    file << key << " " << res.intra << " " << res.micro << " "
+         << res.rate << "\n";
+  }
+
+  // samples/s of training steps (without the optimizer update, the model is
+  // left untouched)
+  template<class PRIOR, class MODEL>
+  double Trial( const PRIOR& prior, MODEL& model, const CLIStore& conf,
+                size_t micro, int steps = 3 )
+  {
+    const auto nset = conf.Get<size_t>("nset");
+    const auto nsamp = conf.Get<size_t>("nsamp");
+    const auto nfeat = conf.Get<size_t>("nfeat");
+
+    model->train();
+    auto step = [&]( )
+    {
+      auto sets = split( prior.Sample(nset, nsamp, nfeat),
+                         torch::randint(1, nsamp, 1).item<int>() );
+      train::Backward( model,
+                       std::get<0>(sets).to(DEVICE), std::get<2>(sets).to(DEVICE),
+                       std::get<1>(sets).to(DEVICE), std::get<3>(sets).to(DEVICE),
+                       micro );
+      model->zero_grad();
+    };
+
+    step(); // warm-up
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < steps; i++)
+      step();
+    if (DEVICE.is_cuda())
+      torch::cuda::synchronize();
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<double> dt = t1 - t0;
+    return double(steps * nset * nsamp) / dt.count();
+  }
+
+  template<class PRIOR, class MODEL>
+  Setting Search( const PRIOR& prior, MODEL& model, const CLIStore& conf )
+  {
+    const auto nset = conf.Get<size_t>("nset");
+    const auto budget = conf.Get<double>("mem-budget") * 1024. * 1024.;
+
+    std::vector<int> intras;
+    if (conf.Get<int>("intra") > 0)
+      intras.push_back(conf.Get<int>("intra"));
+    else
+    {
+      const int ncores = runtime::ncores();
+      for (int t = 1; t < ncores; t *= 2)
+        intras.push_back(t);
+      intras.push_back(ncores);
+    }
+
+    // small to large, once we run out of memory larger ones will as well
+    std::vector<size_t> micros;
+    for (size_t m = nset; m >= 1; m /= 2)
+      micros.insert(micros.begin(), m);
+
+    Setting best;
+    for (int intra : intras)
+    {
+      at::set_num_threads(intra);
+      for (size_t micro : micros)
+      {
+        if (budget > 0. && mem::Estimate(model, micro, 
+                             conf.Get<size_t>("nsamp")).Total() > budget)
+          break;
+
+        double rate;
+        try
+        {
+          rate = Trial(prior, model, conf, micro);
+        }
+        catch (const c10::Error&)
+        {
+          model->zero_grad();
+          break;
+        }
+        PFN_LOG("Autotune intra: " << intra << " micro: " << micro
+                << " -> " << rate << " samples/s");
+        if (rate > best.rate)
+          best = {intra, micro, rate};
+      }
+    }
+    return best;
+  }
+
+  // Pick (or look up) the setting and apply it to conf and libtorch
+  template<class PRIOR, class MODEL>
+  void Autotune( const PRIOR& prior, MODEL& model, CLIStore& conf )
+  {
+    auto path = conf.Get<std::filesystem::path>("tunecache");
+    auto key = Key(model, conf);
+
+    Setting best;
+    if (Lookup(path, key, best))
+      PFN_LOG("Autotune: cached setting for " << key);
+    else
+    {
+      // the trials should not change the random stream of the actual run
+      auto gen = at::detail::getDefaultCPUGenerator();
+      auto state = gen.get_state();
+      model->to(DEVICE);
+      best = Search(prior, model, conf);
+      gen.set_state(state);
+      Store(path, key, best);
+    }
+
+    PFN_LOG("Autotune: intra " << best.intra << " micro " << best.micro
+            << " (" << best.rate << " samples/s)");
+    TORCH_CHECK( best.intra > 0, "Autotune could not run a single trial." );
+    at::set_num_threads(best.intra);
+    conf.Set<int>("intra", best.intra);
+    conf.Set<size_t>("micro", best.micro);
+  }
+}
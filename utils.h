@@ -16,21 +16,31 @@
 #include <fstream>
 #include <filesystem>
 
+//------------------------------------------------------------
+// PFN_LOG: Informative printing, silent when we are built as a library
+//------------------------------------------------------------
+// (a single statement, safe in an unbraced if/else)
+#ifdef PFN_LIBRARY
+#define PFN_LOG(x) do { } while (0)
+#else
+#define PFN_LOG(x) do { std::cout << x << std::endl; } while (0)
+#endif
+
 //------------------------------------------------------------
 // select_divece: Should we use CUDA or CPU?
 //------------------------------------------------------------
 torch::Device select_device()
 {
-  std::cout << "CUDA device count: " << torch::cuda::device_count() << std::endl;
+  PFN_LOG("CUDA device count: " << torch::cuda::device_count());
 
   if (torch::cuda::is_available())
   {
-    std::cout << "CUDA is available. Using GPU 0." << std::endl;
+    PFN_LOG("CUDA is available. Using GPU 0.");
     return torch::Device(torch::kCUDA, 0);
   }
   else
   {
-    std::cout << "CUDA is not available. Using CPU." << std::endl;
+    PFN_LOG("CUDA is not available. Using CPU.");
     return torch::kCPU;
   }
 }
@@ -93,6 +103,12 @@ public:
     return std::get<T>(it->second);  // Return typed value
   }
   /////////////////////////////////////////////////////////////////////////////
+  // Is there a flag with this name?
+  bool Has ( const std::string& name ) const
+  {
+    return flags_.count(name) > 0;
+  }
+  /////////////////////////////////////////////////////////////////////////////
   // Get flag options by name
   template<typename T>
   std::vector<T> GetOptions( const std::string& name ) const
@@ -326,6 +342,31 @@ private:
   }
 };
 
+//-----------------------------------------------------------------------------
+// Arena : named buffers that are reused from step to step. Get gives you the
+// buffer with the requested shape, its storage is only reallocated when it
+// has to grow. Whatever you got last time with the same name is overwritten.
+//-----------------------------------------------------------------------------
+class Arena
+{
+public:
+  torch::Tensor Get( const std::string& name,
+                     at::IntArrayRef sizes,
+                     const torch::TensorOptions& opts = {} )
+  {
+    auto& t = buffers_[name];
+    if (!t.defined() || t.dtype() != opts.dtype() ||
+                        t.device() != opts.device())
+      t = torch::empty(sizes, opts);
+    else
+      t.resize_(sizes);
+    return t;
+  }
+
+private:
+  std::unordered_map<std::string, torch::Tensor> buffers_;
+};
+
 //-----------------------------------------------------------------------------
 // save_checkpoint : given a path it saves the model optimizer and epoch
 //-----------------------------------------------------------------------------
@@ -373,40 +414,103 @@ bool load_checkpoint(const std::string& path,
   }
 }
 
-torch::Tensor get_idx(int Ntotal, int Nsamp)
+//-----------------------------------------------------------------------------
+// split : random train/test split of every dataset (dim 1) of a batch, Ntst
+// test rows each, without replacement. Every dataset gets its own
+// permutation, drawn on the device the data lives on, and every tensor is
+// gathered once into [train; test] order, so both parts are contiguous
+// views of it. The split point is shared, the model takes rectangular
+// batches.
+//-----------------------------------------------------------------------------
+
+// Row order of each dataset, [N, nset] (argsort of uniform noise)
+torch::Tensor perms( int64_t N, int64_t nset, const torch::Device& device )
 {
-  return torch::randint(0,Ntotal-1,Nsamp);
+  return torch::rand({nset, N}, torch::TensorOptions().device(device))
+           .argsort(1).t();
 }
 
-torch::Tensor rest(const torch::Tensor& idx, int N)
+torch::Tensor perms( int64_t N, int64_t nset, const torch::Device& device,
+                     Arena& arena )
 {
-  TORCH_CHECK( idx.dim() == 1, "idx must be 1D" );
-  auto mask = torch::zeros({N-1}, torch::kBool);
-  mask.index_fill_(0, idx, true);
-  return nonzero(~mask).squeeze(1);
+  auto opts = torch::TensorOptions().device(device);
+  auto noise = arena.Get("split.noise", {nset, N}, opts).uniform_();
+  auto sorted = arena.Get("split.sorted", {0}, opts);
+  auto order = arena.Get("split.order", {0}, opts.dtype(torch::kLong));
+  torch::sort_out(sorted, order, noise, 1);
+  return order.t();
 }
 
+// t [N, nset, ...] in the given row order per dataset
+torch::Tensor _permute( const torch::Tensor& t, const torch::Tensor& order )
+{
+  auto idx = order.unsqueeze(2).expand_as(t);
+  return t.gather(0, idx);
+}
+
+torch::Tensor _permute( const char* name, const torch::Tensor& t,
+                        const torch::Tensor& order, Arena& arena )
+{
+  auto idx = order.unsqueeze(2).expand_as(t);
+  auto out = arena.Get(name, t.sizes(), t.options());
+  return torch::gather_out(out, t, 0, idx);
+}
 
 std::tuple<torch::Tensor,torch::Tensor,
           torch::Tensor,torch::Tensor>
             split(const std::tuple<torch::Tensor,torch::Tensor>& set,
                     const int Ntst)
 {
-  int N = std::get<0>(set).size(0);
-  TORCH_CHECK( std::get<0>(set).size(0) == std::get<1>(set).size(0) &&
-               std::get<0>(set).size(1) == std::get<1>(set).size(1),
+  const auto& X = std::get<0>(set);
+  const auto& y = std::get<1>(set);
+  int N = X.size(0);
+  TORCH_CHECK( X.size(0) == y.size(0) && X.size(1) == y.size(1),
+      "X-y pair does not have matching dimensions" );
+  TORCH_CHECK( N > Ntst && Ntst > 0, "Not enough samples to get test samples" );
+
+  auto order = perms(N, X.size(1), X.device());
+  auto Xp = _permute(X, order), yp = _permute(y, order);
+  const int Ntrn = N - Ntst;
+  return std::make_tuple(Xp.narrow(0, 0, Ntrn), Xp.narrow(0, Ntrn, Ntst),
+                         yp.narrow(0, 0, Ntrn), yp.narrow(0, Ntrn, Ntst));
+}
+
+// Same as above but everything is written in the buffers of the arena
+std::tuple<torch::Tensor,torch::Tensor,
+          torch::Tensor,torch::Tensor>
+            split(const std::tuple<torch::Tensor,torch::Tensor>& set,
+                    const int Ntst, Arena& arena)
+{
+  const auto& X = std::get<0>(set);
+  const auto& y = std::get<1>(set);
+  int N = X.size(0);
+  TORCH_CHECK( X.size(0) == y.size(0) && X.size(1) == y.size(1),
       "X-y pair does not have matching dimensions" );
-  TORCH_CHECK( N > Ntst, "Not enough samples to get test samples" );
-
-  auto idx = get_idx(N,Ntst);
-  auto idx_ = rest(idx,N);
-  return std::make_tuple(std::get<0>(set).index_select(0,idx_),
-                         std::get<0>(set).index_select(0,idx),
-                         std::get<1>(set).index_select(0,idx_),
-                         std::get<1>(set).index_select(0,idx));
+  TORCH_CHECK( N > Ntst && Ntst > 0, "Not enough samples to get test samples" );
+
+  auto order = perms(N, X.size(1), X.device(), arena);
+  auto Xp = _permute("split.X", X, order, arena);
+  auto yp = _permute("split.y", y, order, arena);
+  const int Ntrn = N - Ntst;
+  return std::make_tuple(Xp.narrow(0, 0, Ntrn), Xp.narrow(0, Ntrn, Ntst),
+                         yp.narrow(0, 0, Ntrn), yp.narrow(0, Ntrn, Ntst));
 }
 
 
+//-----------------------------------------------------------------------------
+// parse_list : integers of a comma separated list, "50,100,200"
+//-----------------------------------------------------------------------------
+std::vector<int> parse_list( const std::string& list )
+{
+  std::vector<int> res;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    if (!item.empty())
+      res.push_back(std::stoi(item));
+  return res;
+}
+
 void write(const torch::Tensor& t, const std::string& path)
 {
   std::ofstream file(path);
@@ -505,6 +609,28 @@ bool save_checkpoint( const std::filesystem::path& path,
 
 }
 
+//-----------------------------------------------------------------------------
+// load_weights : only the model of a checkpoint, false if it can not be
+// loaded (missing file, other architecture, ...), so that the caller can
+// refuse to go on with an untrained model
+//-----------------------------------------------------------------------------
+bool load_weights( const std::filesystem::path& path,
+                   torch::nn::ModuleHolder<auto> model )
+{
+  try
+  {
+    torch::serialize::InputArchive archive;
+    archive.load_from(path);
+    model->load(archive);
+    return true;
+  }
+  catch (const c10::Error& e)
+  {
+    std::cerr << "Could not load checkpoint: " << e.what() << std::endl;
+    return false;
+  }
+}
+
 int load_checkpoint( const std::filesystem::path& path,
                      torch::nn::ModuleHolder<auto> model )
                       /* torch::optim::Optimizer& optimizer, */